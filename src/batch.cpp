@@ -0,0 +1,149 @@
+#include "batch.h"
+#include "dispatch.h"
+#include "jit.h"
+#include "processor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Instance indices waiting to run on one worker. The owner takes from the
+// back, idle workers steal from the front.
+struct WorkQueue
+{
+	std::mutex lock;
+	std::deque<int> instances;
+};
+
+struct BatchPool
+{
+	const Machine *boot;
+	const std::vector<BatchInstance> *instances;
+	std::vector<BatchResult> *results;
+	std::unique_ptr<WorkQueue[]> queues;
+	Machine *machines;	// one per worker, reused for every instance it runs
+	int threads;
+};
+
+u64 HashMachine(Machine &m)
+{
+	const u16 registers[] = { m.cpu.bc, m.cpu.de, m.cpu.hl, (u16)((m.cpu.a << 8) | GetStatusByte(m)), m.cpu.pc, m.cpu.sp, m.cpu.INTE };
+
+	// FNV-1a
+	u64 hash = 14695981039346656037ull;
+	for (u16 value : registers)
+	{
+		hash = (hash ^ (value & 0xFF)) * 1099511628211ull;
+		hash = (hash ^ (value >> 8)) * 1099511628211ull;
+	}
+	for (int address = 0x2000; address < 0x4000; address++)
+		hash = (hash ^ m.memory[address]) * 1099511628211ull;
+	return hash;
+}
+
+BatchResult RunInstance(Machine &m, const Machine &boot, const BatchInstance &instance)
+{
+	BatchResult result = { 0, 0, 0 };
+
+	CopyMachine(m, boot);
+	for (; result.frames < instance.frames && m.running; result.frames++)
+	{
+		if (result.frames < (int)instance.inputs.size())
+			m.dipswitch_1 = instance.inputs[result.frames];
+		result.instructions += EmulateHalfFrame(m);
+		result.instructions += EmulateHalfFrame(m);
+	}
+
+	result.hash = HashMachine(m);
+	return result;
+}
+
+// Takes the next instance for worker self, stealing once its own queue is
+// empty. Returns -1 when no work is left anywhere.
+int NextInstance(BatchPool &pool, int self)
+{
+	{
+		WorkQueue &own = pool.queues[self];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.instances.empty())
+		{
+			int index = own.instances.back();
+			own.instances.pop_back();
+			return index;
+		}
+	}
+
+	for (int i = 1; i < pool.threads; i++)
+	{
+		WorkQueue &victim = pool.queues[(self + i) % pool.threads];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.instances.empty())
+		{
+			int index = victim.instances.front();
+			victim.instances.pop_front();
+			return index;
+		}
+	}
+
+	return -1;
+}
+
+void RunWorker(BatchPool &pool, int self)
+{
+	Machine &m = pool.machines[self];
+	for (int index = NextInstance(pool, self); index >= 0; index = NextInstance(pool, self))
+		(*pool.results)[index] = RunInstance(m, *pool.boot, (*pool.instances)[index]);
+}
+
+BatchReport RunBatch(const Machine &boot, const std::vector<BatchInstance> &instances, int threads)
+{
+	if (threads <= 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	BatchReport report;
+	report.threads = threads;
+	report.frames = 0;
+	report.instructions = 0;
+	report.results.resize(instances.size());
+
+	// Machines are over-aligned, which plain new only honours from C++17 on
+	std::unique_ptr<u8[]> storage(new u8[threads * sizeof(Machine) + alignof(Machine)]);
+	uintptr_t base = ((uintptr_t)storage.get() + alignof(Machine) - 1) & ~(uintptr_t)(alignof(Machine) - 1);
+
+	BatchPool pool;
+	pool.boot = &boot;
+	pool.instances = &instances;
+	pool.results = &report.results;
+	pool.queues.reset(new WorkQueue[threads]);
+	pool.machines = (Machine*)base;
+	pool.threads = threads;
+
+	// Contiguous runs, so a worker only steals once its own share is done
+	for (int i = 0; i < (int)instances.size(); i++)
+		pool.queues[(long long)i * threads / instances.size()].instances.push_back(i);
+
+	bool jit = jit_enabled;
+	jit_enabled = false;
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (int i = 1; i < threads; i++)
+		workers.emplace_back(RunWorker, std::ref(pool), i);
+	RunWorker(pool, 0);
+	for (std::thread &worker : workers)
+		worker.join();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	jit_enabled = jit;
+
+	report.seconds = elapsed.count();
+	for (const BatchResult &result : report.results)
+	{
+		report.frames += result.frames;
+		report.instructions += result.instructions;
+	}
+	return report;
+}
@@ -0,0 +1,45 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "common.h"
+#include "machine.h"
+
+#include <vector>
+
+// Batch runner: steps many independent machines through whole frames on a
+// work-stealing thread pool. Every instance starts as a copy of the same
+// booted machine and differs only in its input stream, so results do not
+// depend on the thread count or on which thread ran an instance.
+
+struct BatchInstance
+{
+	int frames;
+	std::vector<u8> inputs;	// port 1 (dipswitch_1) for each frame; the last value holds after the end
+};
+
+struct BatchResult
+{
+	int frames;				// fewer than asked for if the machine stopped
+	long long instructions;
+	u64 hash;				// of the CPU state and RAM after the last frame
+};
+
+struct BatchReport
+{
+	int threads;
+	long long frames;
+	long long instructions;
+	double seconds;
+	std::vector<BatchResult> results;	// one per instance, in instance order
+};
+
+// Runs every instance from boot on the given number of threads (0 uses
+// every core). The JIT's block cache is shared without locking, so this
+// runs the interpreter even when the JIT is enabled. Profiling builds count
+// from every thread without synchronisation.
+BatchReport RunBatch(const Machine &boot, const std::vector<BatchInstance> &instances, int threads);
+
+// Hash of the CPU state and RAM, for comparing runs
+u64 HashMachine(Machine &m);
+
+#endif /*BATCH_H*/
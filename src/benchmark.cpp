@@ -0,0 +1,726 @@
+// Benchmark suite for the CPU core, the frame conversion and the frame loop.
+// Built from this file and every source except main.cpp. Results are printed
+// and written as CSV to bench_output.txt in the working directory; the real
+// ROM benchmark runs when invaders.h/g/f/e are present there.
+// Build once as is and once with -DLAZY_FLAGS or -DDECODE_CACHE to compare
+// core modes. Where the JIT is available, emulation benchmarks are repeated
+// on it as well, and random ROMs check it against the interpreter.
+
+#include "processor.h"
+#include "opcodes.h"
+#include "batch.h"
+#include "dispatch.h"
+#include "jit.h"
+#include "lockstep.h"
+#include "machine.h"
+#include "memory.h"
+#include "rewind.h"
+#include "rom.h"
+#include "savestate.h"
+#include "scheduler.h"
+#include "video.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CLOBBER_MEMORY() _ReadWriteBarrier()
+#else
+#define CLOBBER_MEMORY() asm volatile("" : : : "memory")
+#endif
+
+#ifdef LAZY_FLAGS
+#define FLAG_MODE "lazy"
+#else
+#define FLAG_MODE "eager"
+#endif
+
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define DISPATCH_LOOP "threaded"
+#else
+#define DISPATCH_LOOP "table"
+#endif
+
+#ifdef DECODE_CACHE
+#define DISPATCH_MODE DISPATCH_LOOP "+decode_cache"
+#else
+#define DISPATCH_MODE DISPATCH_LOOP
+#endif
+
+// Synthetic ROMs are placed at 0x0020, behind a jump at 0x0000 and
+// EI; RET interrupt handlers at 0x0008 (RST 1) and 0x0010 (RST 2).
+#define SYNTHETIC_ORIGIN 0x20
+
+// ALU loop: most flags are overwritten before anything reads them
+const u8 alu_program[] =
+{
+	0x31, 0x00, 0x24,	// 0020 LXI SP,2400
+	0xFB,				// 0023 EI
+	0x0E, 0x00,			// 0024 MVI C,0
+	0x80,				// 0026 ADD B
+	0x91,				// 0027 SUB C
+	0xA8,				// 0028 XRA B
+	0xB2,				// 0029 ORA D
+	0xA3,				// 002A ANA E
+	0x04,				// 002B INR B
+	0x14,				// 002C INR D
+	0x1D,				// 002D DCR E
+	0x88,				// 002E ADC B
+	0x0D,				// 002F DCR C
+	0xC2, 0x26, 0x00,	// 0030 JNZ 0026
+	0xC3, 0x24, 0x00,	// 0033 JMP 0024
+};
+
+// Compare and branch loop over VRAM: flags are read after almost every ALU op
+const u8 branch_program[] =
+{
+	0x31, 0x00, 0x24,	// 0020 LXI SP,2400
+	0xFB,				// 0023 EI
+	0x21, 0x00, 0x24,	// 0024 LXI H,2400
+	0x7E,				// 0027 MOV A,M
+	0xFE, 0x80,			// 0028 CPI 80
+	0xDA, 0x2E, 0x00,	// 002A JC 002E
+	0x2F,				// 002D CMA
+	0x77,				// 002E MOV M,A
+	0x23,				// 002F INX H
+	0x7C,				// 0030 MOV A,H
+	0xFE, 0x40,			// 0031 CPI 40
+	0xC2, 0x27, 0x00,	// 0033 JNZ 0027
+	0xC3, 0x24, 0x00,	// 0036 JMP 0024
+};
+
+// Block copy and a read loop, the shape of the ROM's copy and scan routines
+const u8 copy_program[] =
+{
+	0x31, 0x00, 0x24,	// 0020 LXI SP,2400
+	0xFB,				// 0023 EI
+	0x11, 0x00, 0x00,	// 0024 LXI D,0000
+	0x21, 0x00, 0x24,	// 0027 LXI H,2400
+	0x06, 0x00,			// 002A MVI B,0
+	0x1A,				// 002C LDAX D
+	0x77,				// 002D MOV M,A
+	0x23,				// 002E INX H
+	0x13,				// 002F INX D
+	0x05,				// 0030 DCR B
+	0xC2, 0x2C, 0x00,	// 0031 JNZ 002C
+	0x21, 0x00, 0x24,	// 0034 LXI H,2400
+	0x06, 0x00,			// 0037 MVI B,0
+	0x7E,				// 0039 MOV A,M
+	0x23,				// 003A INX H
+	0x05,				// 003B DCR B
+	0xC2, 0x39, 0x00,	// 003C JNZ 0039
+	0xC3, 0x24, 0x00,	// 003F JMP 0024
+};
+
+Machine machine;
+FILE *output;
+
+void LoadSyntheticRom(const u8 *program, int size)
+{
+	InitializeMachine(machine);
+
+	const u8 jump[] = { 0xC3, SYNTHETIC_ORIGIN, 0x00 };
+	const u8 handler[] = { 0xFB, 0xC9 };
+	for (int i = 0; i < 3; i++)
+		mem::LoadROM(machine, i, jump[i]);
+	for (int i = 0; i < 2; i++)
+	{
+		mem::LoadROM(machine, 0x08 + i, handler[i]);
+		mem::LoadROM(machine, 0x10 + i, handler[i]);
+	}
+	for (int i = 0; i < size; i++)
+		mem::LoadROM(machine, SYNTHETIC_ORIGIN + i, program[i]);
+}
+
+// Records one result; ops are whatever the benchmark counts (instructions, frames, writes)
+void Report(const char *name, long long ops, double seconds)
+{
+	double ns_per_op = seconds * 1e9 / ops;
+	double mops = ops / seconds / 1e6;
+
+	printf("%-36s %12.2f ns/op %12.2f Mops/s\n", name, ns_per_op, mops);
+	fprintf(output, "%s,%s,%s,%lld,%.3f,%.3f\n", name, FLAG_MODE, DISPATCH_MODE, ops, ns_per_op, mops);
+}
+
+// Times iterations calls of body
+template <typename F>
+void Measure(const char *name, long long iterations, F body)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (long long i = 0; i < iterations; i++)
+	{
+		body();
+		CLOBBER_MEMORY();	// keep the compiler from hoisting or merging iterations
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	Report(name, iterations, elapsed.count());
+}
+
+/********** Opcode handlers **********/
+
+// Calls handlers with PC reset to 0x0000 on every iteration. The operand
+// bytes there make immediates 0x00 and addresses and jump targets 0x2400.
+void BenchmarkOpcodes()
+{
+	const long long n = 50000000;
+
+	Machine &m = machine;
+
+	InitializeMachine(m);
+	mem::LoadROM(m, 0x02, 0x24);
+	mem::LoadROM(m, 0x11, 0x04);	// OUT 4
+	mem::LoadROM(m, 0x21, 0x03);	// IN 3
+	m.cpu.hl = 0x2400;
+	m.cpu.de = 0x2401;
+	m.cpu.bc = 0x2402;
+	SP = 0x2400;
+	DecodeRom(m);
+
+	// Data transfer
+	Measure("op.mov_r_r", n, [&] { PC = 0; MOV<B, C>(m); });
+	Measure("op.mov_r_m", n, [&] { PC = 0; MOV<A, M>(m); });
+	Measure("op.mov_m_r", n, [&] { PC = 0; MOV<M, A>(m); });
+	Measure("op.mvi", n, [&] { PC = 0; MVI<D>(m); });
+	Measure("op.ldax_stax", n, [&] { PC = 0; LDAX<DE>(m); STAX<BC>(m); });
+	Measure("op.lhld_shld", n, [&] { PC = 0; SHLD(m); PC = 0; LHLD(m); });
+
+	// Arithmetic and logic
+	Measure("op.add", n, [&] { PC = 0; ADD<B>(m); });
+	Measure("op.adc_m", n, [&] { PC = 0; ADC<M>(m); });
+	Measure("op.sub", n, [&] { PC = 0; SUB<C>(m); });
+	Measure("op.ana", n, [&] { PC = 0; ANA<D>(m); });
+	Measure("op.xra", n, [&] { PC = 0; XRA<E>(m); });
+	Measure("op.cmp", n, [&] { PC = 0; CMP<L>(m); });
+	Measure("op.cpi", n, [&] { PC = 0; CPI(m); });
+	Measure("op.inr", n, [&] { PC = 0; INR<B>(m); });
+	Measure("op.dcr_m", n, [&] { PC = 0; DCR<M>(m); });
+	Measure("op.daa", n, [&] { PC = 0; DAA(m); });
+	Measure("op.rotate", n, [&] { PC = 0; RLC(m); RAR(m); });
+
+	// Register pairs and stack
+	Measure("op.lxi", n, [&] { PC = 0; LXI<SP_PAIR>(m); SP = 0x2400; });
+	Measure("op.inx_dcx", n, [&] { PC = 0; INX<BC>(m); DCX<DE>(m); });
+	Measure("op.dad", n, [&] { PC = 0; DAD<DE>(m); });
+	Measure("op.xchg", n, [&] { PC = 0; XCHG(m); });
+	Measure("op.push_pop", n, [&] { PC = 0; PUSH<BC>(m); POP<DE>(m); });
+	Measure("op.push_pop_psw", n, [&] { PC = 0; PUSH<PSW>(m); POP<PSW>(m); });
+
+	// Branches
+	Measure("op.jmp", n, [&] { PC = 0; JMP(m); });
+	Measure("op.jnz", n, [&] { PC = 0; JNZ(m); });
+	Measure("op.call_ret", n, [&] { PC = 0; CALL(m); RET(m); });
+	Measure("op.rst_ret", n, [&] { PC = 0; RST<1>(m); RET(m); });
+
+	// I/O
+	Measure("op.out_in", n, [&] { PC = 0x10; OUT(m); PC = 0x20; IN(m); });
+}
+
+/********** Dispatch **********/
+
+void BenchmarkDispatch(const char *name, const u8 *program, int size)
+{
+	const long long n = 100000000;
+	char full_name[64];
+
+	LoadSyntheticRom(program, size);
+	snprintf(full_name, sizeof(full_name), "dispatch.execute.%s", name);
+	Measure(full_name, n, [] { ExecuteInstruction(machine); });
+
+	// Emulate8080 reports its own instruction count
+	LoadSyntheticRom(program, size);
+	long long instructions = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 5000; i++)
+		instructions += Emulate8080(machine, 16666);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	snprintf(full_name, sizeof(full_name), "dispatch.emulate.%s", name);
+	Report(full_name, instructions, elapsed.count());
+
+	if (!InitializeJit())
+		return;
+
+	LoadSyntheticRom(program, size);
+	ResetJit();
+	instructions = 0;
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 5000; i++)
+		instructions += Emulate8080(machine, 16666);
+	elapsed = std::chrono::steady_clock::now() - start;
+	jit_enabled = false;
+	snprintf(full_name, sizeof(full_name), "dispatch.jit.%s", name);
+	Report(full_name, instructions, elapsed.count());
+}
+
+/********** Memory and video **********/
+
+void BenchmarkMemory()
+{
+	const long long n = 100000000;
+	static u16 address = 0;
+
+	Measure("mem.write_ram", n, [] { mem::Write(machine, 0x2000 + (address & 0x1FFF), 0xAA); address++; });
+	Measure("mem.write_mirror", n, [] { mem::Write(machine, 0x4000 + (address & 0x1FFF), 0x55); address++; });
+	Measure("mem.read", n, [] { machine.cpu.a += mem::Read(machine, address); address++; });
+}
+
+void BenchmarkVideo()
+{
+	static u32 pixels[WIDTH * HEIGHT];
+	static u32 reference[WIDTH * HEIGHT];
+
+	for (int i = 0x2400; i < 0x4000; i++)
+		machine.memory[i] = (u8)(i * 37);
+	Measure("video.convert_frame", 5000, [] { ConvertFrame(machine, pixels); });
+	Measure("video.convert_frame.reference", 500, [] { ConvertFrameReference(machine, reference); });
+	if (memcmp(pixels, reference, sizeof(pixels)))
+		printf("video.convert_frame: " VIDEO_KERNEL " kernel differs from the reference\n");
+
+	// Dirty tracking: a frame where nothing was written, one where a byte was
+	// rewritten with its own value and one where a sprite byte in each of
+	// eight columns moved
+	static VideoFrame frame;
+	InitializeVideoFrame(frame, pixels);
+	UpdateFrame(machine, frame);
+	Measure("video.update_frame.idle", 100000, [] { UpdateFrame(machine, frame); });
+	Measure("video.update_frame.rewritten", 100000, [] {
+		mem::Write(machine, 0x3000, mem::Read(machine, 0x3000));
+		UpdateFrame(machine, frame);
+	});
+	static u8 sprite = 0;
+	Measure("video.update_frame.sprite", 20000, [] {
+		sprite++;
+		for (int x = 0; x < 8; x++)
+			mem::Write(machine, 0x3000 + x * 0x20 + 7 * x, sprite);
+		UpdateFrame(machine, frame);
+	});
+
+	// Handing a frame to the display thread, and taking it there
+	static FrameExchange exchange;
+	InitializeExchange(exchange);
+	Measure("video.publish_frame", 100000, [] { PublishFrame(exchange, machine, 0); });
+	Measure("video.publish_take_frame", 100000, [] {
+		PublishFrame(exchange, machine, 0);
+		TakeFrame(exchange);
+	});
+}
+
+/********** Save states **********/
+
+// Snapshots taken mid-game and put back, as search workloads do
+void BenchmarkSaveStates()
+{
+	static SaveState snapshot;
+
+	Measure("state.save", 1000000, [] { SaveMachine(machine, snapshot); });
+	Measure("state.restore", 1000000, [] { RestoreMachine(machine, snapshot); });
+}
+
+/********** Full frames **********/
+
+// Runs whole frames: two half-frame slices with their interrupts
+long long RunFrames(int frames)
+{
+	long long instructions = 0;
+	for (int i = 0; i < frames && machine.running; i++)
+	{
+		instructions += EmulateHalfFrame(machine);
+		instructions += EmulateHalfFrame(machine);
+	}
+	return instructions;
+}
+
+// The same driven by the event scheduler: each event is a half-frame
+// boundary with its interrupt
+long long RunScheduledFrames(int frames)
+{
+	Scheduler scheduler;
+	InitializeScheduler(scheduler);
+	ScheduleInterrupts(scheduler, machine);
+
+	long long instructions = 0;
+	for (int i = 0; i < 2 * frames && machine.running; i++)
+		instructions += RunToNextEvent(scheduler, machine);
+	return instructions;
+}
+
+void TimeFrames(const char *name, int frames, long long (*run)(int) = RunFrames)
+{
+	char full_name[96];
+
+	auto start = std::chrono::steady_clock::now();
+	long long instructions = run(frames);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	snprintf(full_name, sizeof(full_name), "frame.%s", name);
+	Report(full_name, frames, elapsed.count());
+	snprintf(full_name, sizeof(full_name), "frame.%s.instructions", name);
+	Report(full_name, instructions, elapsed.count());
+}
+
+// Reference for RunFrames() that steps with ExecuteInstruction() alone, so
+// without threaded dispatch, superinstructions, idle skipping or the JIT.
+// on_opcode sees every opcode before it runs.
+template <typename F>
+long long StepFrames(int frames, F on_opcode)
+{
+	Machine &m = machine;
+	long long instructions = 0;
+	for (int i = 0; i < frames && m.running; i++)
+	{
+		for (int half = 0; half < 2; half++)
+		{
+			long long boundary = (m.cycles / HALF_FRAME_CYCLES + 1) * HALF_FRAME_CYCLES;
+			while (m.cycles < boundary)
+			{
+				if (m.halted)
+				{
+					m.cycles = boundary;	// waits for the interrupt
+					break;
+				}
+				on_opcode(mem::Read(m, PC));
+				m.cycles += ExecuteInstruction(m);
+				instructions++;
+			}
+
+			if (m.cpu.INTE)
+			{
+				GenerateInterrupt(m, ((boundary / HALF_FRAME_CYCLES) & 1) ? 0x08 : 0x10);
+				m.cpu.INTE = 0;
+			}
+		}
+	}
+	return instructions;
+}
+
+// Machine state the frame benchmarks start from and compare
+struct Snapshot
+{
+	state cpu;
+	long long cycles;
+	bool running;
+	u8 memory[sizeof(machine.memory)];
+};
+
+void Save(Snapshot &snapshot)
+{
+	snapshot.cpu = machine.cpu;
+	snapshot.cycles = machine.cycles;
+	snapshot.running = machine.running;
+	memcpy(snapshot.memory, machine.memory, sizeof(machine.memory));
+}
+
+void Restore(const Snapshot &snapshot)
+{
+	machine.cpu = snapshot.cpu;
+	machine.cycles = snapshot.cycles;
+	machine.running = snapshot.running;
+	memcpy(machine.memory, snapshot.memory, sizeof(machine.memory));
+	FlushDecodeCache(machine);
+}
+
+bool Matches(const Snapshot &snapshot)
+{
+	return !memcmp(&snapshot.cpu, &machine.cpu, sizeof(state)) && snapshot.cycles == machine.cycles &&
+		!memcmp(snapshot.memory, machine.memory, sizeof(machine.memory));
+}
+
+// Prints the most frequent opcode pairs, the candidates for FUSIONS in dispatch.cpp
+void PrintPairs(const char *name, long long pairs[256][256], long long total)
+{
+	const int top = 8;
+	int best[top] = {};
+
+	for (int i = 0; i < top; i++)
+	{
+		for (int pair = 0; pair < 256 * 256; pair++)
+		{
+			bool taken = false;
+			for (int j = 0; j < i; j++)
+				taken |= (best[j] == pair);
+			if (!taken && pairs[pair >> 8][pair & 0xFF] > pairs[best[i] >> 8][best[i] & 0xFF])
+				best[i] = pair;
+		}
+		printf("pairs.%-30s %02X %02X %10.2f %%\n", name, best[i] >> 8, best[i] & 0xFF,
+			100.0 * pairs[best[i] >> 8][best[i] & 0xFF] / total);
+	}
+}
+
+// Times the loaded program on the threaded core and checks it against the
+// stepped reference, whose run also records the opcode pair profile. The
+// JIT then runs from the same start and must end in the same state.
+void BenchmarkFrames(const char *name)
+{
+	const int frames = 20000;
+	static Snapshot start, end;
+	static long long pairs[256][256];
+	static int previous;
+	char jit_name[64];
+	char scheduled_name[64];
+
+	Save(start);
+	long long start_cycles = machine.cycles;
+	long long start_skipped = machine.skipped_cycles;
+	TimeFrames(name, frames);
+	Save(end);
+	printf("idle.%-31s %12.2f %% of cycles skipped\n", name,
+		100.0 * (machine.skipped_cycles - start_skipped) / (machine.cycles - start_cycles));
+
+	Restore(start);
+	memset(pairs, 0, sizeof(pairs));
+	previous = 0;
+	long long instructions = StepFrames(frames, [](u8 opcode) { pairs[previous][opcode]++; previous = opcode; });
+	if (!Matches(end))
+		printf("frame.%s: state differs from the stepped reference\n", name);
+	PrintPairs(name, pairs, instructions);
+
+	Restore(start);
+	snprintf(scheduled_name, sizeof(scheduled_name), "%s.scheduled", name);
+	TimeFrames(scheduled_name, frames, RunScheduledFrames);
+	if (!Matches(end))
+		printf("frame.%s: state differs from the half-frame loop\n", scheduled_name);
+
+	if (!InitializeJit())
+		return;
+
+	Restore(start);
+	snprintf(jit_name, sizeof(jit_name), "%s.jit", name);
+	TimeFrames(jit_name, frames);
+	jit_enabled = false;
+
+	if (!Matches(end))
+		printf("frame.%s: JIT state differs from the interpreter\n", jit_name);
+}
+
+/********** JIT equivalence **********/
+
+// Fills ROM with random bytes from seed: every opcode and operand in
+// roughly equal measure, including the undocumented ones, so the code
+// reads and writes all over memory and jumps between short blocks. HLT is
+// left out, as a random program would soon halt with interrupts off and
+// stop running anything.
+void LoadRandomRom(Machine &m, u32 seed)
+{
+	InitializeMachine(m);
+	for (int address = 0; address < ROM_SIZE; address++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		u8 value = (u8)(seed >> 24);
+		mem::LoadROM(m, address, (value == 0x76) ? 0x00 : value);
+	}
+	DecodeRom(m);
+}
+
+// Runs random ROMs on the interpreter and on the JIT side by side and
+// checks that both end every half frame with the same state hash, cycle
+// count, write count and dirty pages. Dropped writes are not compared:
+// the cores see different spin loops to skip, and the loops may store to
+// ROM. This stands in for CPU test ROMs, which exercise the instructions
+// one at a time but not the block translator's budget checks and exits.
+void CheckJit(int roms, int frames)
+{
+	static Machine reference, translated;
+	long long instructions = 0;
+	int differing = 0;
+
+	if (!InitializeJit())
+		return;
+	jit_enabled = false;
+
+	for (int rom = 0; rom < roms; rom++)
+	{
+		LoadRandomRom(reference, rom);
+		CopyMachine(translated, reference);
+		ResetJit();
+
+		for (int half = 0; half < 2 * frames; half++)
+		{
+			instructions += EmulateHalfFrame(reference);
+			jit_enabled = true;
+			EmulateHalfFrame(translated);
+			jit_enabled = false;
+
+			if (HashMachine(reference) != HashMachine(translated) || reference.cycles != translated.cycles ||
+				reference.writes != translated.writes ||
+				memcmp(reference.dirty_pages, translated.dirty_pages, sizeof(reference.dirty_pages)))
+			{
+				if (differing++ < 8)
+					printf("jit.random: ROM %d differs from the interpreter in half frame %d\n", rom, half);
+				break;
+			}
+		}
+	}
+
+	printf("jit.random: %d of %d ROMs match over %lld instructions\n", roms - differing, roms, instructions);
+}
+
+// Runs the same batch on one thread and on every core. Per core throughput
+// close to the single thread figure means the batch scales linearly.
+void BenchmarkBatch(const char *name)
+{
+	const int instances = 64;
+	std::vector<BatchInstance> batch(instances);
+	char full_name[64];
+
+	for (int i = 0; i < instances; i++)
+	{
+		batch[i].frames = 500;
+		batch[i].inputs.assign(500, (u8)(i & 0x70));
+	}
+
+	BatchReport single = RunBatch(machine, batch, 1);
+	BatchReport all = RunBatch(machine, batch, 0);
+
+	snprintf(full_name, sizeof(full_name), "batch.%s.1", name);
+	Report(full_name, single.frames, single.seconds);
+	snprintf(full_name, sizeof(full_name), "batch.%s.%d", name, all.threads);
+	Report(full_name, all.frames, all.seconds);
+	snprintf(full_name, sizeof(full_name), "batch.%s.%d.per_core", name, all.threads);
+	Report(full_name, all.frames, all.seconds * all.threads);
+
+	for (int i = 0; i < instances; i++)
+		if (single.results[i].hash != all.results[i].hash)
+		{
+			printf("batch.%s: instance %d differs between thread counts\n", name, i);
+			break;
+		}
+}
+
+// Runs LOCKSTEP_LANES copies of the loaded program on the lockstep core and
+// the same instances one machine at a time, with every lane fed the same
+// input or with inputs that differ per lane and keep the lanes apart
+void BenchmarkLockstep(const char *name, bool same_inputs)
+{
+	const int frames = 500;
+	static Machine lanes[LOCKSTEP_LANES];
+	static LockstepGroup group;
+	Machine *pointers[LOCKSTEP_LANES];
+	std::vector<BatchInstance> batch(LOCKSTEP_LANES);
+	const char *inputs = same_inputs ? "same" : "mixed";
+	char full_name[64];
+
+	for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+	{
+		batch[lane].frames = frames;
+		for (int frame = 0; frame < frames; frame++)
+			batch[lane].inputs.push_back(same_inputs ? 0 : (u8)(((frame / 30 + lane) & 7) << 4));
+		CopyMachine(lanes[lane], machine);
+		pointers[lane] = &lanes[lane];
+	}
+
+	BatchReport scalar = RunBatch(machine, batch, 1);
+
+	long long instructions = 0;
+	group.vector_instructions = group.scalar_instructions = 0;
+	LoadLanes(group, pointers);
+	auto start = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+			lanes[lane].dipswitch_1 = batch[lane].inputs[frame];
+		instructions += EmulateLockstepHalfFrame(group);
+		instructions += EmulateLockstepHalfFrame(group);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	StoreLanes(group);
+
+	snprintf(full_name, sizeof(full_name), "lockstep.%s.%s.scalar", name, inputs);
+	Report(full_name, scalar.instructions, scalar.seconds);
+	snprintf(full_name, sizeof(full_name), "lockstep.%s.%s.%d_lanes", name, inputs, LOCKSTEP_LANES);
+	Report(full_name, instructions, elapsed.count());
+	printf("lockstep.%s.%s: %.1f%% of instructions ran in vector kernels\n", name, inputs,
+		100.0 * group.vector_instructions / (group.vector_instructions + group.scalar_instructions));
+
+	for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+		if (HashMachine(lanes[lane]) != scalar.results[lane].hash)
+		{
+			printf("lockstep.%s.%s: lane %d differs from the scalar run\n", name, inputs, lane);
+			break;
+		}
+}
+
+// Records a minute of play into a rewind buffer holding the last ten
+// seconds, then jumps back to the oldest frame it still holds
+void BenchmarkRewind(const char *name)
+{
+	const int frames = 3600;
+	static RewindBuffer rewind;
+	static u64 hashes[frames];
+	std::chrono::duration<double> recording(0);
+	char full_name[64];
+
+	InitializeRewind(rewind, 600, 60, 4 << 20);
+	for (int frame = 0; frame < frames && machine.running; frame++)
+	{
+		machine.dipswitch_1 = (u8)(((frame / 30) & 7) << 4);
+		EmulateHalfFrame(machine);
+		EmulateHalfFrame(machine);
+
+		auto start = std::chrono::steady_clock::now();
+		RecordFrame(rewind, machine);
+		recording += std::chrono::steady_clock::now() - start;
+		hashes[frame] = HashMachine(machine);
+	}
+
+	snprintf(full_name, sizeof(full_name), "rewind.%s.record", name);
+	Report(full_name, rewind.frames_recorded, recording.count());
+
+	int back = RewindDepth(rewind) - 1;
+	long long target = rewind.next - 1 - back;
+	auto start = std::chrono::steady_clock::now();
+	Rewind(rewind, machine, back);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	snprintf(full_name, sizeof(full_name), "rewind.%s.restore_%d_frames", name, back);
+	Report(full_name, 1, elapsed.count());
+	printf("rewind.%s: %.0f bytes per frame, %lld keyframes in %lld frames\n", name,
+		AverageBytesPerFrame(rewind), rewind.keyframes_recorded, rewind.frames_recorded);
+	if (HashMachine(machine) != hashes[target])
+		printf("rewind.%s: state differs from the recorded frame\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	output = fopen("bench_output.txt", "w");
+	if (output == NULL)
+	{
+		printf("Cannot open bench_output.txt\n");
+		return 1;
+	}
+	fprintf(output, "benchmark,flags,dispatch,ops,ns_per_op,mops_per_s\n");
+
+	BenchmarkOpcodes();
+
+	BenchmarkDispatch("alu", alu_program, sizeof(alu_program));
+	BenchmarkDispatch("branch", branch_program, sizeof(branch_program));
+	BenchmarkDispatch("copy", copy_program, sizeof(copy_program));
+
+	BenchmarkMemory();
+	BenchmarkVideo();
+
+	LoadSyntheticRom(alu_program, sizeof(alu_program));
+	BenchmarkFrames("synthetic_alu");
+	LoadSyntheticRom(branch_program, sizeof(branch_program));
+	BenchmarkFrames("synthetic_branch");
+	LoadSyntheticRom(copy_program, sizeof(copy_program));
+	BenchmarkFrames("synthetic_copy");
+	CheckJit(300, 30);
+	BenchmarkSaveStates();
+
+	InitializeMachine(machine);
+	if (LoadRom(machine, "."))
+	{
+		BenchmarkBatch("invaders");
+		BenchmarkLockstep("invaders", true);
+		BenchmarkLockstep("invaders", false);
+		BenchmarkFrames("invaders");
+		BenchmarkRewind("invaders");
+	}
+	else
+		printf("invaders.h/g/f/e not found, skipping frame.invaders\n");
+
+	fclose(output);
+	return 0;
+}
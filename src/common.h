@@ -6,15 +6,25 @@
 #define u8 uint8_t
 #define u16 uint16_t
 #define u32 uint32_t
+#define u64 uint64_t
 
-#define ACC i8080.registers[7]
-#define PC i8080.pc
-#define SP i8080.sp
-#define SIGN i8080.status[0]
-#define ZERO i8080.status[1]
-#define CARRY i8080.status[3]
-#define AUX_CARRY i8080.status[4]
-#define PARITY i8080.status[2]
-#define H_L ((i8080.registers[4] << 8) | (i8080.registers[5]))
+// Register and flag shorthands, for code with the running Machine in scope as m
+#define ACC m.cpu.a
+#define PC m.cpu.pc
+#define SP m.cpu.sp
+#define SIGN (m.cpu.flags & FLAG_S)
+#define ZERO (m.cpu.flags & FLAG_Z)
+#define CARRY (m.cpu.flags & FLAG_C)
+#define AUX_CARRY (m.cpu.flags & FLAG_AC)
+#define PARITY (m.cpu.flags & FLAG_P)
+
+// Status bits in PSW layout
+#define FLAG_S 0x80
+#define FLAG_Z 0x40
+#define FLAG_AC 0x10
+#define FLAG_P 0x04
+#define FLAG_1 0x02
+#define FLAG_C 0x01
+#define H_L m.cpu.hl
 
 #endif /*COMMON_H*/
@@ -0,0 +1,39 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include "common.h"
+
+struct Machine;
+
+// Executes the instruction at PC and returns the cycles it took
+typedef int (*OpcodeHandler)(Machine &m);
+
+#ifdef DECODE_CACHE
+
+// Decoded-instruction cache (-DDECODE_CACHE): every address maps to the
+// handler of the opcode stored there and the two bytes after it, assembled
+// into the operand NextByte() and NextAddress() return. ROM is decoded once
+// by LoadRom(); other entries are decoded on first use and dropped again
+// when a write touches any of their three bytes. Each Machine has its own.
+struct DecodedInstruction
+{
+	OpcodeHandler handler;
+	u16 operand;		// bytes at address + 1 (low) and address + 2 (high)
+	u8 opcode;
+	bool valid;
+};
+
+void DecodeInstruction(Machine &m, u16 address);
+
+#endif
+
+// Decodes 0x0000-0x1FFF up front
+void DecodeRom(Machine &m);
+
+// Drops every decoded entry; needed after memory is changed without mem::Write
+void FlushDecodeCache(Machine &m);
+
+// Drops the decoded entries that include a byte in pages first to last
+void FlushDecodedPages(Machine &m, int first, int last);
+
+#endif /*DECODE_H*/
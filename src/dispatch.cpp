@@ -0,0 +1,419 @@
+#include "dispatch.h"
+#include "opcodes.h"
+#include "jit.h"
+#include "idle.h"
+
+#include <utility>
+
+#define REG_PAIR ((opcode & 0x30) >> 4)
+#define DDD ((opcode & 0x38) >> 3)
+#define EXP ((opcode & 0x38) >> 3)
+#define SSS (opcode & 0x07)
+
+// Expands X once for every 8080 opcode
+#define OPCODES(X) \
+	X(0x00) X(0x01) X(0x02) X(0x03) X(0x04) X(0x05) X(0x06) X(0x07) X(0x08) X(0x09) X(0x0A) X(0x0B) X(0x0C) X(0x0D) X(0x0E) X(0x0F) \
+	X(0x10) X(0x11) X(0x12) X(0x13) X(0x14) X(0x15) X(0x16) X(0x17) X(0x18) X(0x19) X(0x1A) X(0x1B) X(0x1C) X(0x1D) X(0x1E) X(0x1F) \
+	X(0x20) X(0x21) X(0x22) X(0x23) X(0x24) X(0x25) X(0x26) X(0x27) X(0x28) X(0x29) X(0x2A) X(0x2B) X(0x2C) X(0x2D) X(0x2E) X(0x2F) \
+	X(0x30) X(0x31) X(0x32) X(0x33) X(0x34) X(0x35) X(0x36) X(0x37) X(0x38) X(0x39) X(0x3A) X(0x3B) X(0x3C) X(0x3D) X(0x3E) X(0x3F) \
+	X(0x40) X(0x41) X(0x42) X(0x43) X(0x44) X(0x45) X(0x46) X(0x47) X(0x48) X(0x49) X(0x4A) X(0x4B) X(0x4C) X(0x4D) X(0x4E) X(0x4F) \
+	X(0x50) X(0x51) X(0x52) X(0x53) X(0x54) X(0x55) X(0x56) X(0x57) X(0x58) X(0x59) X(0x5A) X(0x5B) X(0x5C) X(0x5D) X(0x5E) X(0x5F) \
+	X(0x60) X(0x61) X(0x62) X(0x63) X(0x64) X(0x65) X(0x66) X(0x67) X(0x68) X(0x69) X(0x6A) X(0x6B) X(0x6C) X(0x6D) X(0x6E) X(0x6F) \
+	X(0x70) X(0x71) X(0x72) X(0x73) X(0x74) X(0x75) X(0x76) X(0x77) X(0x78) X(0x79) X(0x7A) X(0x7B) X(0x7C) X(0x7D) X(0x7E) X(0x7F) \
+	X(0x80) X(0x81) X(0x82) X(0x83) X(0x84) X(0x85) X(0x86) X(0x87) X(0x88) X(0x89) X(0x8A) X(0x8B) X(0x8C) X(0x8D) X(0x8E) X(0x8F) \
+	X(0x90) X(0x91) X(0x92) X(0x93) X(0x94) X(0x95) X(0x96) X(0x97) X(0x98) X(0x99) X(0x9A) X(0x9B) X(0x9C) X(0x9D) X(0x9E) X(0x9F) \
+	X(0xA0) X(0xA1) X(0xA2) X(0xA3) X(0xA4) X(0xA5) X(0xA6) X(0xA7) X(0xA8) X(0xA9) X(0xAA) X(0xAB) X(0xAC) X(0xAD) X(0xAE) X(0xAF) \
+	X(0xB0) X(0xB1) X(0xB2) X(0xB3) X(0xB4) X(0xB5) X(0xB6) X(0xB7) X(0xB8) X(0xB9) X(0xBA) X(0xBB) X(0xBC) X(0xBD) X(0xBE) X(0xBF) \
+	X(0xC0) X(0xC1) X(0xC2) X(0xC3) X(0xC4) X(0xC5) X(0xC6) X(0xC7) X(0xC8) X(0xC9) X(0xCA) X(0xCB) X(0xCC) X(0xCD) X(0xCE) X(0xCF) \
+	X(0xD0) X(0xD1) X(0xD2) X(0xD3) X(0xD4) X(0xD5) X(0xD6) X(0xD7) X(0xD8) X(0xD9) X(0xDA) X(0xDB) X(0xDC) X(0xDD) X(0xDE) X(0xDF) \
+	X(0xE0) X(0xE1) X(0xE2) X(0xE3) X(0xE4) X(0xE5) X(0xE6) X(0xE7) X(0xE8) X(0xE9) X(0xEA) X(0xEB) X(0xEC) X(0xED) X(0xEE) X(0xEF) \
+	X(0xF0) X(0xF1) X(0xF2) X(0xF3) X(0xF4) X(0xF5) X(0xF6) X(0xF7) X(0xF8) X(0xF9) X(0xFA) X(0xFB) X(0xFC) X(0xFD) X(0xFE) X(0xFF)
+
+// Decodes a single opcode at compile time. The switch folds away for every
+// instantiation, leaving a direct call with the operand fields already bound.
+template <u8 opcode>
+int Decoded(Machine &m)
+{
+	switch (opcode)
+	{
+		/* 00000000 */
+	case 0x00: return NOP(m);
+		/* 00xxxxxx */
+	case 0x07: return RLC(m);
+	case 0x0F: return RRC(m);
+	case 0x17: return RAL(m);
+	case 0x1F: return RAR(m);
+	case 0x22: return SHLD(m);
+	case 0x27: return DAA(m);
+	case 0x2A: return LHLD(m);
+	case 0x2F: return CMA(m);
+	case 0x32: return STA(m);
+	case 0x37: return STC(m);
+	case 0x3A: return LDA(m);
+	case 0x3F: return CMC(m);
+		/* 00xxx000, undocumented NOPs */
+	case 0x08: case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: return NOP(m);
+		/* 01110110 */
+	case 0x76: return HLT(m);
+		/* 11xxxxxx */
+	case 0xC0: return RNZ(m);
+	case 0xC2: return JNZ(m);
+	case 0xC3: return JMP(m);
+	case 0xC4: return CNZ(m);
+	case 0xC6: return ADI(m);
+	case 0xC8: return RZ(m);
+	case 0xC9: return RET(m);
+	case 0xCA: return JZ(m);
+	case 0xCC: return CZ(m);
+	case 0xCE: return ACI(m);
+	case 0xCD: return CALL(m);
+	case 0xD0: return RNC(m);
+	case 0xD2: return JNC(m);
+	case 0xD3: return OUT(m);
+	case 0xD4: return CNC(m);
+	case 0xD6: return SUI(m);
+	case 0xD8: return RC(m);
+	case 0xDA: return JC(m);
+	case 0xDB: return IN(m);
+	case 0xDC: return CC(m);
+	case 0xDE: return SBI(m);
+	case 0xE0: return RPO(m);
+	case 0xE2: return JPO(m);
+	case 0xE3: return XTHL(m);
+	case 0xE4: return CPO(m);
+	case 0xE6: return ANI(m);
+	case 0xE8: return RPE(m);
+	case 0xE9: return PCHL(m);
+	case 0xEA: return JPE(m);
+	case 0xEB: return XCHG(m);
+	case 0xEC: return CPE(m);
+	case 0xEE: return XRI(m);
+	case 0xF0: return RP(m);
+	case 0xF2: return JP(m);
+	case 0xF3: return DI(m);
+	case 0xF4: return CP(m);
+	case 0xF6: return ORI(m);
+	case 0xF8: return RM(m);
+	case 0xF9: return SPHL(m);
+	case 0xFC: return CM(m);
+	case 0xFA: return JM(m);
+	case 0xFB: return EI(m);
+	case 0xFE: return CPI(m);
+		/* 11xxxxxx, undocumented duplicates */
+	case 0xCB: return JMP(m);
+	case 0xD9: return RET(m);
+	case 0xDD: case 0xED: case 0xFD: return CALL(m);
+		/* Other */
+	default:
+		switch ((opcode & 0xC0) >> 6) // Get two leftmost bits
+		{
+			/* 00xxxxxx */
+		case 0:
+			if ((opcode & 0x07) < 4) // Get three rightmost bits
+			{
+				switch (opcode & 0x0F)
+				{
+				case 1:		return LXI<REG_PAIR>(m);	// 00xx0001
+				case 2:		return STAX<REG_PAIR>(m);	// 00xx0010
+				case 3:		return INX<REG_PAIR>(m);	// 00xx0011
+				case 9:		return DAD<REG_PAIR>(m);	// 00xx1001
+				case 10:	return LDAX<REG_PAIR>(m);	// 00xx1010
+				case 11:	return DCX<REG_PAIR>(m);	// 00xx1011
+				}
+			}
+			else
+			{
+				switch (opcode & 0x07)
+				{
+				case 4:		return INR<DDD>(m);	// 00xxx100
+				case 5:		return DCR<DDD>(m);	// 00xxx101
+				case 6:		return MVI<DDD>(m);	// 00xxx110
+				}
+			}
+			break;
+
+			/* 01xxxxxx */
+		case 1: return MOV<SSS, DDD>(m);
+
+			/* 10xxxxxx */
+		case 2:
+			switch ((opcode & 0x38) >> 3)
+			{
+			case 0: return ADD<SSS>(m);	// 10000xxx
+			case 1: return ADC<SSS>(m);	// 10001xxx
+			case 2: return SUB<SSS>(m);	// 10010xxx
+			case 3: return SBB<SSS>(m);	// 10011xxx
+			case 4: return ANA<SSS>(m);	// 10100xxx
+			case 5: return XRA<SSS>(m);	// 10101xxx
+			case 6: return ORA<SSS>(m);	// 10110xxx
+			case 7: return CMP<SSS>(m);	// 10111xxx
+			}
+			break;
+
+			/* 11xxxxxx */
+		case 3:
+			switch (opcode & 0x07)
+			{
+			case 1: return POP<REG_PAIR>(m);	// 11xxx001
+			case 5: return PUSH<REG_PAIR>(m);	// 11xxx101
+			case 7: return RST<EXP>(m);		// 11xxx111
+			}
+			break;
+		}
+	}
+
+	// Unreachable: every opcode is decoded above
+	return 4;
+}
+
+template <std::size_t... I>
+constexpr std::array<OpcodeHandler, 256> MakeDispatchTable(std::index_sequence<I...>)
+{
+	return {{ &Decoded<I>... }};
+}
+
+constexpr std::array<OpcodeHandler, 256> dispatch_table = MakeDispatchTable(std::make_index_sequence<256>());
+
+#ifdef DECODE_CACHE
+
+void DecodeInstruction(Machine &m, u16 address)
+{
+	// mem::Write invalidates by where a byte is stored, so an instruction
+	// read through a mirror or from unmapped space is decoded for this one
+	// fetch only
+	bool cacheable = true;
+	for (int i = 0; i < 3; i++)
+	{
+		u16 byte = address + i;
+		m.decoded_pages[byte >> 8] = true;
+		if (m.read_pages[byte >> 8] != HomePage(m, byte >> 8))
+			cacheable = false;
+	}
+
+	DecodedInstruction &instruction = m.decode_cache[address];
+	instruction.opcode = mem::Read(m, address);
+	instruction.handler = dispatch_table[instruction.opcode];
+	instruction.operand = (mem::Read(m, address + 2) << 8) | mem::Read(m, address + 1);
+	instruction.valid = cacheable;
+}
+
+void DecodeRom(Machine &m)
+{
+	for (int address = 0; address < ROM_SIZE; address++)
+		DecodeInstruction(m, address);
+}
+
+void FlushDecodeCache(Machine &m)
+{
+	for (int address = 0; address < 0x10000; address++)
+		m.decode_cache[address].valid = false;
+	for (int page = 0; page < 0x100; page++)
+		m.decoded_pages[page] = false;
+}
+
+void FlushDecodedPages(Machine &m, int first, int last)
+{
+	for (int page = first; page <= last; page++)
+	{
+		if (!m.decoded_pages[page])
+			continue;
+
+		// Instructions starting up to two bytes before the page reach into it
+		for (int address = (page << 8) - 2; address < (page + 1) << 8; address++)
+			m.decode_cache[(u16)address].valid = false;
+		m.decoded_pages[page] = false;
+	}
+}
+
+// Looks up the instruction at PC, decoding it if needed
+inline const DecodedInstruction &FetchDecoded(Machine &m)
+{
+	const DecodedInstruction &instruction = m.decode_cache[PC];
+	if (!instruction.valid)
+		DecodeInstruction(m, PC);
+	return instruction;
+}
+
+int ExecuteInstruction(Machine &m)
+{
+	const DecodedInstruction &instruction = FetchDecoded(m);
+	PROFILE_INSTRUCTION(instruction.opcode, PC);
+	return PROFILE_CYCLES(instruction.opcode, instruction.handler(m));
+}
+
+#else
+
+void DecodeRom(Machine &m)
+{
+}
+
+void FlushDecodeCache(Machine &m)
+{
+}
+
+void FlushDecodedPages(Machine &m, int first, int last)
+{
+}
+
+int ExecuteInstruction(Machine &m)
+{
+	u8 opcode = mem::Read(m, PC);
+	PROFILE_INSTRUCTION(opcode, PC);
+	return PROFILE_CYCLES(opcode, dispatch_table[opcode](m));
+}
+
+#endif
+
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+
+// Superinstructions: when the first opcode of a pair has run and the next
+// opcode is the second, the second body is entered directly instead of
+// through the dispatch jump. Pairs chain, and the budget is still checked
+// between the two, so slices end on the same instruction as without fusion.
+// Each first opcode can have one successor, listed as X(first, second).
+// The list is empty: no pair from the top of the benchmark's pair profile
+// (MOV A,M; INX H, LDAX D; MOV M,A, MOV M,A; INX H, DCR B; JNZ, ADD B;
+// MOV M,A and others) ran measurably faster fused. Only add one that does.
+#define FUSIONS(X)
+
+// Threaded dispatch: every opcode body ends in its own indirect jump, which
+// gives the branch predictor one history per opcode instead of a shared one.
+int Emulate8080(Machine &m, int cycles)
+{
+#define LABEL_ADDRESS(op) &&op_##op,
+	static void *const labels[256] = { OPCODES(LABEL_ADDRESS) };
+#undef LABEL_ADDRESS
+
+	if (jit_enabled)
+		return EmulateJit(m, cycles);
+
+	int elapsed_cycles = 0;
+	int instructions = 0;
+	u16 loop_from = 0;
+
+	ResetIdleLoop(m);
+	CheckHalted(m, elapsed_cycles, cycles);
+
+#ifdef DECODE_CACHE
+// Spelled out rather than calling FetchDecoded(), which is not inlined into 256 sites
+#define DISPATCH() \
+	if (elapsed_cycles >= cycles) goto done; \
+	if (!m.decode_cache[PC].valid) DecodeInstruction(m, PC); \
+	goto *labels[m.decode_cache[PC].opcode]
+#define NEXT_OPCODE() (m.decode_cache[PC].valid ? m.decode_cache[PC].opcode : -1)
+#else
+#define DISPATCH() \
+	if (elapsed_cycles >= cycles) goto done; \
+	goto *labels[mem::Read(m, PC)]
+#define NEXT_OPCODE() mem::Read(m, PC)
+#endif
+
+	DISPATCH();
+
+	// The comparisons against current fold away, leaving the check only in
+	// the bodies of first opcodes
+#define FUSED_JUMP(first, second) \
+	if (current == first && elapsed_cycles < cycles && NEXT_OPCODE() == second) \
+		goto op_##second;
+
+	// Only jumps and HLT look for idle time; the tests fold away elsewhere.
+	// Backward jumps share one idle check, so its call to TrackIdleLoop()
+	// does not make every opcode body keep its state on the stack.
+#define LABEL_BODY(op) \
+	op_##op: \
+	{ \
+		enum { current = op }; \
+		u16 from = PC; \
+		PROFILE_INSTRUCTION(op, PC); \
+		elapsed_cycles += PROFILE_CYCLES(op, Decoded<op>(m)); \
+		instructions++; \
+		if (IDLE_SKIP && IsLoopJump(current) && PC <= from) \
+		{ \
+			loop_from = from; \
+			goto loop_jump; \
+		} \
+		if (current == 0x76) \
+			CheckHalted(m, elapsed_cycles, cycles); \
+		FUSIONS(FUSED_JUMP) \
+	} \
+	DISPATCH();
+
+	OPCODES(LABEL_BODY)
+
+loop_jump:
+	CheckIdleLoop(m, loop_from, elapsed_cycles, instructions, cycles);
+	DISPATCH();
+
+done:
+	m.cycles += elapsed_cycles;
+	return instructions;
+
+#undef LABEL_BODY
+#undef FUSED_JUMP
+#undef NEXT_OPCODE
+#undef DISPATCH
+}
+
+#else
+
+int Emulate8080(Machine &m, int cycles)
+{
+	if (jit_enabled)
+		return EmulateJit(m, cycles);
+
+	int elapsed_cycles = 0;
+	int instructions = 0;
+
+	ResetIdleLoop(m);
+	CheckHalted(m, elapsed_cycles, cycles);
+	while (elapsed_cycles < cycles)
+	{
+		u16 from = PC;
+		elapsed_cycles += ExecuteInstruction(m);
+		instructions++;
+
+		// Backward moves are rare enough to look at the opcode only then
+		if (PC <= from && IsLoopJump(mem::Read(m, from)))
+			CheckIdleLoop(m, from, elapsed_cycles, instructions, cycles);
+		CheckHalted(m, elapsed_cycles, cycles);
+	}
+
+	m.cycles += elapsed_cycles;
+	return instructions;
+}
+
+#endif
+
+void MidScreenInterrupt(Machine &m)
+{
+	if (m.cpu.INTE)
+	{
+		GenerateInterrupt(m, 0x08);
+		m.cpu.INTE = 0;
+	}
+}
+
+void VblankInterrupt(Machine &m)
+{
+	if (m.cpu.INTE)
+	{
+		GenerateInterrupt(m, 0x10);
+		m.cpu.INTE = 0;
+	}
+}
+
+void EndHalfFrame(Machine &m)
+{
+	if ((m.cycles / HALF_FRAME_CYCLES) & 1)
+		MidScreenInterrupt(m);
+	else
+		VblankInterrupt(m);
+}
+
+int EmulateHalfFrame(Machine &m)
+{
+	long long boundary = (m.cycles / HALF_FRAME_CYCLES + 1) * HALF_FRAME_CYCLES;
+	int instructions = Emulate8080(m, (int)(boundary - m.cycles));
+	EndHalfFrame(m);
+	return instructions;
+}
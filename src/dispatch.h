@@ -0,0 +1,38 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include "common.h"
+#include "decode.h"
+#include "machine.h"
+
+#include <array>
+
+// One pre-decoded handler per opcode
+extern const std::array<OpcodeHandler, 256> dispatch_table;
+
+int ExecuteInstruction(Machine &m);
+
+// Runs for at least the given number of cycles and adds the cycles run to
+// Machine::cycles; returns instructions executed
+int Emulate8080(Machine &m, int cycles);
+
+#define CLOCK_RATE 2000000	// cycles per second
+
+// The beam passes mid-screen at odd multiples of HALF_FRAME_CYCLES and
+// enters vblank at even ones
+#define HALF_FRAME_CYCLES ((CLOCK_RATE / 60) / 2)
+#define FRAME_CYCLES (2 * HALF_FRAME_CYCLES)
+
+// RST 1 and RST 2, raised if interrupts are enabled
+void MidScreenInterrupt(Machine &m);
+void VblankInterrupt(Machine &m);
+
+// Raises the interrupt of the half-frame boundary the machine last passed
+void EndHalfFrame(Machine &m);
+
+// Runs up to the next half-frame boundary, then raises its interrupt. The
+// last instruction may run past the boundary; those cycles count towards
+// the next half frame.
+int EmulateHalfFrame(Machine &m);
+
+#endif /*DISPATCH_H*/
@@ -0,0 +1,29 @@
+#include "idle.h"
+
+#include <cstring>
+
+IdleSkip TrackIdleLoop(Machine &m, int elapsed_cycles, int instructions, int cycles)
+{
+	IdleLoop &idle = m.idle;
+	IdleSkip skip = { 0, 0 };
+	// CheckIdleLoop() has seen the same PC, write count and register pairs
+	if (idle.valid && idle.shift_register == m.shift_register &&
+		idle.shift_offset == m.shift_offset && !memcmp(&idle.cpu, &m.cpu, sizeof(state)) &&
+		elapsed_cycles < cycles)
+	{
+		int period = elapsed_cycles - idle.elapsed;
+		int iterations = (cycles - elapsed_cycles) / period;
+		skip.cycles = iterations * period;
+		skip.instructions = iterations * (instructions - idle.instructions);
+		m.skipped_cycles += skip.cycles;
+	}
+
+	// Copied whole, padding included, so the comparison above is exact
+	memcpy(&idle.cpu, &m.cpu, sizeof(state));
+	idle.shift_register = m.shift_register;
+	idle.shift_offset = m.shift_offset;
+	idle.elapsed = elapsed_cycles + skip.cycles;
+	idle.instructions = instructions + skip.instructions;
+	idle.valid = true;
+	return skip;
+}
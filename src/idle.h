@@ -0,0 +1,100 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include "common.h"
+#include "machine.h"
+
+#include <cstring>
+
+// Idle skipping (-DNO_IDLE_SKIP turns it off). Space Invaders spends most of
+// a frame polling RAM flags that the interrupt handlers set. When a short
+// backward jump lands the CPU where it was at the previous one, with no
+// registers, shift register or memory changed in between, the machine can
+// only go round the same loop until something from outside happens, and
+// nothing does before the core's budget runs out. The core then credits
+// the whole iterations that fit in the budget without running them, and
+// runs the last partial one, so each slice ends exactly where it would
+// have. Loops that copy, draw or count are turned away cheaply: the whole
+// state is only snapshotted and compared once a jump lands where the last
+// one did with no write in between and the same register pairs. HLT simply
+// burns the budget until an interrupt clears Machine::halted. Profiling
+// builds run every loop, so the counts stay true to the program.
+
+#if !defined(NO_IDLE_SKIP) && !defined(PROFILE)
+#define IDLE_SKIP 1
+#else
+#define IDLE_SKIP 0
+#endif
+
+#define MAX_IDLE_LOOP 64		// bytes between a loop's start and its jump back
+
+inline bool IsLoopJump(u8 opcode)
+{
+	return opcode == 0xC3 || (opcode & 0xC7) == 0xC2;	// JMP, Jcc
+}
+
+// Forgets the last loop; each Emulate8080() call starts with it
+inline void ResetIdleLoop(Machine &m)
+{
+	m.idle.seen = false;
+	m.idle.valid = false;
+}
+
+// What TrackIdleLoop() credits without running
+struct IdleSkip
+{
+	int cycles;
+	int instructions;
+};
+
+// Skips whole iterations if the machine is where the last snapshot left
+// it, else takes one for the next time round. Takes the counts by value so
+// the cores can keep theirs in registers.
+IdleSkip TrackIdleLoop(Machine &m, int elapsed_cycles, int instructions, int cycles);
+
+// The cheap part, after a jump from from to PC: true once a short backward
+// jump lands where the last one did with no write in between and the same
+// register pairs, when TrackIdleLoop() is due
+inline bool LoopMayBeIdle(Machine &m, u16 from)
+{
+#if IDLE_SKIP
+	if (PC <= from && from - PC < MAX_IDLE_LOOP)
+	{
+		IdleLoop &idle = m.idle;
+		u64 registers;
+		memcpy(&registers, &m.cpu, sizeof(registers));
+		if (idle.seen && idle.pc == PC && idle.writes == m.writes && idle.registers == registers)
+			return true;
+
+		idle.pc = PC;
+		idle.writes = m.writes;
+		idle.registers = registers;
+		idle.seen = true;
+		idle.valid = false;
+	}
+#endif
+	return false;
+}
+
+// Called after a jump from from to PC
+inline void CheckIdleLoop(Machine &m, u16 from, int &elapsed_cycles, int &instructions, int cycles)
+{
+	if (LoopMayBeIdle(m, from))
+	{
+		IdleSkip skip = TrackIdleLoop(m, elapsed_cycles, instructions, cycles);
+		elapsed_cycles += skip.cycles;
+		instructions += skip.instructions;
+	}
+}
+
+// A halted CPU waits out the budget
+inline void CheckHalted(Machine &m, int &elapsed_cycles, int cycles)
+{
+	if (m.halted && elapsed_cycles < cycles)
+	{
+		m.skipped_cycles += cycles - elapsed_cycles;
+		elapsed_cycles = cycles;
+	}
+}
+
+#endif /*IDLE_H*/
@@ -0,0 +1,94 @@
+#include "input.h"
+
+#include <cstring>
+
+const InputBit input_bits[INPUT_COUNT] =
+{
+	{ "coin", 1, 0x01 },
+	{ "p1_start", 1, 0x04 },
+	{ "p2_start", 1, 0x02 },
+	{ "p1_fire", 1, 0x10 },
+	{ "p1_left", 1, 0x20 },
+	{ "p1_right", 1, 0x40 },
+	{ "p2_fire", 2, 0x10 },
+	{ "p2_left", 2, 0x20 },
+	{ "p2_right", 2, 0x40 },
+	{ "tilt", 2, 0x04 },
+};
+
+int FindInput(const char *name)
+{
+	for (int input = 0; input < INPUT_COUNT; input++)
+		if (!strcmp(input_bits[input].name, name))
+			return input;
+	return -1;
+}
+
+/********** Latency **********/
+
+void AddLatency(LatencyHistogram &h, double ms)
+{
+	int bucket = (int)ms;
+	if (bucket >= LATENCY_BUCKETS)
+		bucket = LATENCY_BUCKETS - 1;
+	h.counts[bucket < 0 ? 0 : bucket]++;
+	h.samples++;
+	h.total_ms += ms;
+	if (ms > h.max_ms)
+		h.max_ms = ms;
+}
+
+int LatencyPercentile(const LatencyHistogram &h, double fraction)
+{
+	long long seen = 0;
+	for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+	{
+		seen += h.counts[bucket];
+		if (seen > 0 && seen >= fraction * h.samples)
+			return bucket + 1;
+	}
+	return LATENCY_BUCKETS;
+}
+
+/********** Input exchange **********/
+
+void InitializeInputExchange(InputExchange &x)
+{
+	x.latest = 0;
+	memset(x.held, 0, sizeof(x.held));
+	x.changes = 0;
+	memset(x.times, 0, sizeof(x.times));
+	x.presented = 0;
+	x.applied = 0;
+}
+
+void PressInput(InputExchange &x, int input, bool down, long long time)
+{
+	u8 held = x.held[input];
+	x.held[input] = down ? held + 1 : (held > 0 ? held - 1 : 0);
+	if ((held != 0) == (x.held[input] != 0))
+		return;		// another key bound to the same input is still down
+
+	x.changes++;
+	x.times[x.changes % INPUT_HISTORY] = time;
+	x.latest.store(InputPorts(x.held) | ((u32)x.changes << 16), std::memory_order_release);
+}
+
+u16 ApplyInputs(InputExchange &x, Machine &m)
+{
+	u32 latest = x.latest.load(std::memory_order_acquire);
+	ApplyInputPorts(m, (u16)latest);
+	x.applied = (u16)(latest >> 16);
+	return x.applied;
+}
+
+void InputsPresented(InputExchange &x, u16 applied, long long time, LatencyHistogram &h)
+{
+	// Change numbers wrap; anything further back than the history is lost
+	u16 shown = (u16)(applied - x.presented);
+	if (shown > INPUT_HISTORY)
+		shown = INPUT_HISTORY;
+	for (u16 change = (u16)(applied - shown + 1); shown > 0; change++, shown--)
+		AddLatency(h, (time - x.times[change % INPUT_HISTORY]) / 1e6);
+	x.presented = applied;
+}
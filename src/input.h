@@ -0,0 +1,113 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "common.h"
+#include "machine.h"
+
+#include <atomic>
+
+// Player input. The cabinet's buttons and joysticks are bits of input ports
+// 1 and 2 (Machine::dipswitch_1 and dipswitch_2); the other bits of those
+// ports are dipswitches and are left alone. The front end collects the
+// inputs held on its own thread and hands them to the machine thread
+// through an InputExchange, where a scheduled event applies them. Every
+// change is numbered; published frames carry the number of the last change
+// applied before them, so the front end can time each change from when it
+// happened to the first frame presented after it.
+
+enum
+{
+	INPUT_COIN,
+	INPUT_P1_START,
+	INPUT_P2_START,
+	INPUT_P1_FIRE,
+	INPUT_P1_LEFT,
+	INPUT_P1_RIGHT,
+	INPUT_P2_FIRE,
+	INPUT_P2_LEFT,
+	INPUT_P2_RIGHT,
+	INPUT_TILT,
+	INPUT_COUNT
+};
+
+struct InputBit
+{
+	const char *name;	// as written in binding files
+	u8 port;			// 1 or 2
+	u8 mask;
+};
+
+extern const InputBit input_bits[INPUT_COUNT];
+
+// Bits of each port driven by inputs
+#define PORT_1_INPUTS 0x77
+#define PORT_2_INPUTS 0x74
+
+// Index into input_bits of the input called name, or -1
+int FindInput(const char *name);
+
+// Input bits of both ports, port 1 in the low byte
+inline u16 InputPorts(const u8 *held)
+{
+	u16 ports = 0;
+	for (int input = 0; input < INPUT_COUNT; input++)
+		if (held[input])
+			ports |= input_bits[input].port == 1 ? input_bits[input].mask : input_bits[input].mask << 8;
+	return ports;
+}
+
+inline void ApplyInputPorts(Machine &m, u16 ports)
+{
+	m.dipswitch_1 = (m.dipswitch_1 & ~PORT_1_INPUTS) | (ports & PORT_1_INPUTS);
+	m.dipswitch_2 = (m.dipswitch_2 & ~PORT_2_INPUTS) | ((ports >> 8) & PORT_2_INPUTS);
+}
+
+/********** Latency **********/
+
+#define LATENCY_BUCKETS 100		// 1 ms each; the last one also takes everything longer
+
+struct LatencyHistogram
+{
+	long long counts[LATENCY_BUCKETS];
+	long long samples;
+	double total_ms;
+	double max_ms;
+};
+
+void AddLatency(LatencyHistogram &h, double ms);
+
+// Upper edge in ms of the bucket holding the given fraction of samples
+int LatencyPercentile(const LatencyHistogram &h, double fraction);
+
+/********** Input exchange **********/
+
+#define INPUT_HISTORY 64	// changes timed between two presented frames; older ones go unmeasured
+
+struct InputExchange
+{
+	std::atomic<u32> latest;	// InputPorts() of the held inputs, their change number above
+
+	// Kept by the front end
+	u8 held[INPUT_COUNT];		// keys down per input
+	u16 changes;
+	long long times[INPUT_HISTORY];	// of the latest changes, by change number
+	u16 presented;				// last change seen in a presented frame
+
+	// Kept by the machine side
+	u16 applied;				// last change applied
+};
+
+void InitializeInputExchange(InputExchange &x);
+
+// Front end: a key bound to input went down or up at time (steady clock ns)
+void PressInput(InputExchange &x, int input, bool down, long long time);
+
+// Machine side: puts the latest inputs into the ports. Returns the number
+// of the last change applied, to tag published frames with.
+u16 ApplyInputs(InputExchange &x, Machine &m);
+
+// Front end: a frame tagged applied was presented at time; times the
+// changes it is the first to show
+void InputsPresented(InputExchange &x, u16 applied, long long time, LatencyHistogram &h);
+
+#endif /*INPUT_H*/
@@ -0,0 +1,630 @@
+#include "jit.h"
+#include "dispatch.h"
+#include "processor.h"
+#include "idle.h"
+
+#include <cstddef>
+#include <cstring>
+
+bool jit_enabled = false;
+
+// Translated blocks bypass the profiler hooks, so profiling builds interpret
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(PROFILE)
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define CODE_BUFFER_SIZE (8 * 1024 * 1024)
+#define MAX_BLOCK_INSTRUCTIONS 32
+#define MAX_INSTRUCTION_BYTES 160	// largest emitted instruction plus its budget check
+#define MAX_BLOCK_BYTES (64 + MAX_BLOCK_INSTRUCTIONS * MAX_INSTRUCTION_BYTES)
+
+// Shared with the generated code, which keeps these in registers while it runs
+struct JitContext
+{
+	int elapsed;		// ebx
+	int cycles;			// r12d
+	int instructions;	// r13d
+	Machine *machine;	// r14, which addresses its state as the CPU comes first
+};
+
+typedef void (*JitBlock)(JitContext *context);
+
+u8 *code_buffer = NULL;
+u8 *code_cursor = NULL;
+
+JitBlock block_cache[ROM_SIZE];
+bool untranslatable[ROM_SIZE];
+
+// Offsets of the register operands inside state; M (6) goes through EmitRead() and EmitWrite()
+const u8 register_offset[8] =
+{
+	offsetof(state, b), offsetof(state, c), offsetof(state, d), offsetof(state, e),
+	offsetof(state, h), offsetof(state, l), 0, offsetof(state, a),
+};
+const u8 pair_offset[4] = { offsetof(state, bc), offsetof(state, de), offsetof(state, hl), offsetof(state, sp) };
+const u8 pc_offset = offsetof(state, pc);
+const u8 flags_offset = offsetof(state, flags);
+static_assert(offsetof(Machine, cpu) == 0, "generated code addresses the CPU state through the Machine pointer");
+
+/********** Decoding **********/
+
+inline int InstructionLength(u8 opcode)
+{
+	switch (opcode)
+	{
+	case 0x22: case 0x2A: case 0x32: case 0x3A:	// SHLD, LHLD, STA, LDA
+	case 0xC3: case 0xCD:						// JMP, CALL
+	case 0xCB: case 0xDD: case 0xED: case 0xFD:	// undocumented JMP, CALLs
+		return 3;
+	case 0xD3: case 0xDB:						// OUT, IN
+		return 2;
+	}
+	if ((opcode & 0xCF) == 0x01) return 3;		// LXI
+	if ((opcode & 0xC7) == 0x06) return 2;		// MVI
+	if ((opcode & 0xC7) == 0xC2) return 3;		// Jcc
+	if ((opcode & 0xC7) == 0xC4) return 3;		// Ccc
+	if ((opcode & 0xC7) == 0xC6) return 2;		// ALU immediate
+	return 1;
+}
+
+// Instructions that may leave PC anywhere other than the next instruction
+inline bool EndsBlock(u8 opcode)
+{
+	switch (opcode)
+	{
+	case 0x76:									// HLT
+	case 0xC3: case 0xC9: case 0xCD: case 0xE9:	// JMP, RET, CALL, PCHL
+	case 0xCB: case 0xD9: case 0xDD: case 0xED: case 0xFD:	// undocumented JMP, RET, CALLs
+		return true;
+	}
+	switch (opcode & 0xC7)
+	{
+	case 0xC0: case 0xC2: case 0xC4: case 0xC7:	// Rcc, Jcc, Ccc, RST
+		return true;
+	}
+	return false;
+}
+
+/********** Code emission **********/
+
+inline void Emit8(u8 value)
+{
+	*code_cursor++ = value;
+}
+
+inline void Emit16(u16 value)
+{
+	memcpy(code_cursor, &value, 2);
+	code_cursor += 2;
+}
+
+inline void Emit32(u32 value)
+{
+	memcpy(code_cursor, &value, 4);
+	code_cursor += 4;
+}
+
+inline void Emit64(u64 value)
+{
+	memcpy(code_cursor, &value, 8);
+	code_cursor += 8;
+}
+
+void EmitPrologue()
+{
+	Emit8(0x53);							// push rbx
+	Emit8(0x41); Emit8(0x54);				// push r12
+	Emit8(0x41); Emit8(0x55);				// push r13
+	Emit8(0x41); Emit8(0x56);				// push r14
+	Emit8(0x41); Emit8(0x57);				// push r15
+	Emit8(0x48); Emit8(0x83); Emit8(0xEC); Emit8(0x20);	// sub rsp, 32 (shadow space, keeps rsp 16-aligned)
+#ifdef _WIN32
+	Emit8(0x49); Emit8(0x89); Emit8(0xCF);	// mov r15, rcx
+#else
+	Emit8(0x49); Emit8(0x89); Emit8(0xFF);	// mov r15, rdi
+#endif
+	Emit8(0x41); Emit8(0x8B); Emit8(0x1F);	// mov ebx, [r15]
+	Emit8(0x45); Emit8(0x8B); Emit8(0x67); Emit8(offsetof(JitContext, cycles));		// mov r12d, [r15 + cycles]
+	Emit8(0x45); Emit8(0x8B); Emit8(0x6F); Emit8(offsetof(JitContext, instructions));	// mov r13d, [r15 + instructions]
+	Emit8(0x4D); Emit8(0x8B); Emit8(0x77); Emit8(offsetof(JitContext, machine));	// mov r14, [r15 + machine]
+}
+
+void EmitEpilogue()
+{
+	Emit8(0x41); Emit8(0x89); Emit8(0x1F);	// mov [r15], ebx
+	Emit8(0x45); Emit8(0x89); Emit8(0x6F); Emit8(offsetof(JitContext, instructions));	// mov [r15 + instructions], r13d
+	Emit8(0x48); Emit8(0x83); Emit8(0xC4); Emit8(0x20);	// add rsp, 32
+	Emit8(0x41); Emit8(0x5F);				// pop r15
+	Emit8(0x41); Emit8(0x5E);				// pop r14
+	Emit8(0x41); Emit8(0x5D);				// pop r13
+	Emit8(0x41); Emit8(0x5C);				// pop r12
+	Emit8(0x5B);							// pop rbx
+	Emit8(0xC3);							// ret
+}
+
+void EmitSetPC(u16 address)
+{
+	Emit8(0x66); Emit8(0x41); Emit8(0xC7); Emit8(0x46); Emit8(pc_offset); Emit16(address);	// mov word [r14 + pc], address
+}
+
+// Counts one executed instruction of a known cycle cost
+void EmitRetire(u8 cycles)
+{
+	Emit8(0x83); Emit8(0xC3); Emit8(cycles);	// add ebx, cycles
+	Emit8(0x41); Emit8(0xFF); Emit8(0xC5);		// inc r13d
+}
+
+// Leaves the block when the budget is used up, with PC at the next instruction
+void EmitBudgetCheck(u16 address, bool pc_synced)
+{
+	Emit8(0x44); Emit8(0x39); Emit8(0xE3);	// cmp ebx, r12d
+	Emit8(0x7C);							// jl over the exit
+	u8 *skip = code_cursor++;
+	if (!pc_synced)
+		EmitSetPC(address);
+	EmitEpilogue();
+	*skip = (u8)(code_cursor - skip - 1);
+}
+
+// Calls the interpreter's handler, which advances PC and returns its cycles
+void EmitHandlerCall(u8 opcode)
+{
+#ifdef _WIN32
+	Emit8(0x4C); Emit8(0x89); Emit8(0xF1);	// mov rcx, r14
+#else
+	Emit8(0x4C); Emit8(0x89); Emit8(0xF7);	// mov rdi, r14
+#endif
+	int64_t offset = (int64_t)(uintptr_t)dispatch_table[opcode] - (int64_t)(uintptr_t)(code_cursor + 5);
+	if (offset == (int32_t)offset)
+	{
+		int32_t rel = (int32_t)offset;
+		Emit8(0xE8); memcpy(code_cursor, &rel, 4); code_cursor += 4;	// call handler
+	}
+	else
+	{
+		Emit8(0x48); Emit8(0xB8); Emit64((u64)dispatch_table[opcode]);	// mov rax, handler
+		Emit8(0xFF); Emit8(0xD0);			// call rax
+	}
+	Emit8(0x01); Emit8(0xC3);				// add ebx, eax
+	Emit8(0x41); Emit8(0xFF); Emit8(0xC5);	// inc r13d
+}
+
+/********** Memory **********/
+
+// mem::Read(): loads the byte at the address in pair into eax through the
+// page tables. Clobbers ecx and rdx.
+void EmitRead(int pair)
+{
+	Emit8(0x41); Emit8(0x0F); Emit8(0xB7); Emit8(0x46); Emit8(pair_offset[pair]);	// movzx eax, word [r14 + pair]
+	Emit8(0x89); Emit8(0xC1);				// mov ecx, eax
+	Emit8(0xC1); Emit8(0xE9); Emit8(0x08);	// shr ecx, 8
+	Emit8(0x49); Emit8(0x8B); Emit8(0x94); Emit8(0xCE); Emit32(offsetof(Machine, read_pages));	// mov rdx, [r14 + rcx*8 + read_pages]
+	Emit8(0x0F); Emit8(0xB6); Emit8(0xC0);	// movzx eax, al
+	Emit8(0x0F); Emit8(0xB6); Emit8(0x04); Emit8(0x02);	// movzx eax, byte [rdx + rax]
+}
+
+#ifndef DECODE_CACHE
+
+// mem::Write() of sil to the address in pair, counting the write and
+// marking its page dirty, or dropping it. Clobbers eax, ecx and rdx.
+// Decode cache builds call the handler instead, which also invalidates.
+void EmitWrite(int pair)
+{
+	Emit8(0x41); Emit8(0x0F); Emit8(0xB7); Emit8(0x46); Emit8(pair_offset[pair]);	// movzx eax, word [r14 + pair]
+	Emit8(0x89); Emit8(0xC1);				// mov ecx, eax
+	Emit8(0xC1); Emit8(0xE9); Emit8(0x08);	// shr ecx, 8
+	Emit8(0x49); Emit8(0x8B); Emit8(0x94); Emit8(0xCE); Emit32(offsetof(Machine, write_pages));	// mov rdx, [r14 + rcx*8 + write_pages]
+	Emit8(0x48); Emit8(0x85); Emit8(0xD2);	// test rdx, rdx
+	Emit8(0x74);							// jz to the dropped write
+	u8 *dropped = code_cursor++;
+
+	Emit8(0x0F); Emit8(0xB6); Emit8(0xC0);	// movzx eax, al
+	Emit8(0x40); Emit8(0x88); Emit8(0x34); Emit8(0x02);	// mov [rdx + rax], sil
+	Emit8(0x49); Emit8(0xFF); Emit8(0x86); Emit32(offsetof(Machine, writes));	// inc qword [r14 + writes]
+
+	// The page it is stored in, which differs from the address in the mirror
+	Emit8(0x4C); Emit8(0x29); Emit8(0xF2);	// sub rdx, r14
+	Emit8(0x48); Emit8(0x81); Emit8(0xEA); Emit32(offsetof(Machine, memory));	// sub rdx, memory
+	Emit8(0x48); Emit8(0xC1); Emit8(0xEA); Emit8(0x08);	// shr rdx, 8
+	Emit8(0x41); Emit8(0xC6); Emit8(0x84); Emit8(0x16); Emit32(offsetof(Machine, dirty_pages)); Emit8(0xFF);	// mov byte [r14 + rdx + dirty_pages], 0xFF
+	Emit8(0xEB);							// jmp over the dropped write
+	u8 *done = code_cursor++;
+
+	*dropped = (u8)(code_cursor - dropped - 1);
+	Emit8(0x49); Emit8(0xFF); Emit8(0x86); Emit32(offsetof(Machine, dropped_writes));	// inc qword [r14 + dropped_writes]
+	*done = (u8)(code_cursor - done - 1);
+}
+
+#endif
+
+#ifndef LAZY_FLAGS
+
+// Looks up S, Z and P of the result in eax, merges them with the carry and
+// aux carry in edx and stores the status byte. AC comes out of the
+// (a ^ b ^ result) & 0x10 identity, which matches the aux carry tables.
+void EmitStoreFlags()
+{
+	Emit8(0x48); Emit8(0xBE); Emit64((u64)szp_table.flags);	// mov rsi, szp_table
+	Emit8(0x0A); Emit8(0x14); Emit8(0x06);	// or dl, [rsi + rax]
+	Emit8(0x41); Emit8(0x88); Emit8(0x56); Emit8(flags_offset);	// mov [r14 + flags], dl
+}
+
+// Register, memory or immediate to accumulator; operation is bits 3-5 of
+// the opcode (ADD, ADC, SUB, SBB, ANA, XRA, ORA, CMP)
+void EmitAlu(int operation, int source, bool immediate)
+{
+	bool subtract = (operation == 2 || operation == 3 || operation == 7);
+
+	if (immediate)
+	{
+		Emit8(0xB9); Emit8(source); Emit8(0); Emit8(0); Emit8(0);	// mov ecx, imm
+	}
+	else if (source == M)
+	{
+		EmitRead(HL);
+		Emit8(0x89); Emit8(0xC1);			// mov ecx, eax
+	}
+	else
+	{
+		Emit8(0x41); Emit8(0x0F); Emit8(0xB6); Emit8(0x4E); Emit8(register_offset[source]);	// movzx ecx, byte [r14 + src]
+	}
+	Emit8(0x41); Emit8(0x0F); Emit8(0xB6); Emit8(0x46); Emit8(register_offset[A]);	// movzx eax, byte [r14 + a]
+
+	switch (operation)
+	{
+	case 0: case 1: case 2: case 3: case 7:
+		Emit8(0x89); Emit8(0xC2);			// mov edx, eax
+		Emit8(0x31); Emit8(0xCA);			// xor edx, ecx
+		Emit8(subtract ? 0x29 : 0x01); Emit8(0xC8);	// add/sub eax, ecx
+		if (operation == 1 || operation == 3)
+		{
+			Emit8(0x41); Emit8(0x0F); Emit8(0xB6); Emit8(0x76); Emit8(flags_offset);	// movzx esi, byte [r14 + flags]
+			Emit8(0x83); Emit8(0xE6); Emit8(FLAG_C);	// and esi, FLAG_C
+			Emit8(subtract ? 0x29 : 0x01); Emit8(0xF0);	// add/sub eax, esi
+		}
+		Emit8(0x31); Emit8(0xC2);			// xor edx, eax
+		Emit8(0x83); Emit8(0xE2); Emit8(FLAG_AC);	// and edx, FLAG_AC
+		if (subtract)
+		{
+			Emit8(0x83); Emit8(0xF2); Emit8(FLAG_AC);	// xor edx, FLAG_AC
+		}
+		Emit8(0x89); Emit8(0xC1);			// mov ecx, eax
+		Emit8(0xC1); Emit8(0xE9); Emit8(0x08);	// shr ecx, 8
+		Emit8(0x83); Emit8(0xE1); Emit8(FLAG_C);	// and ecx, FLAG_C
+		Emit8(0x09); Emit8(0xCA);			// or edx, ecx
+		Emit8(0x0F); Emit8(0xB6); Emit8(0xC0);	// movzx eax, al
+		break;
+	case 4:
+		Emit8(0x89); Emit8(0xC2);			// mov edx, eax
+		Emit8(0x09); Emit8(0xCA);			// or edx, ecx
+		Emit8(0x83); Emit8(0xE2); Emit8(0x08);	// and edx, 8
+		Emit8(0xD1); Emit8(0xE2);			// shl edx, 1
+		Emit8(0x21); Emit8(0xC8);			// and eax, ecx
+		break;
+	case 5: case 6:
+		Emit8(0x31); Emit8(0xD2);			// xor edx, edx
+		Emit8(operation == 5 ? 0x31 : 0x09); Emit8(0xC8);	// xor/or eax, ecx
+		break;
+	}
+
+	if (operation != 7)
+	{
+		Emit8(0x41); Emit8(0x88); Emit8(0x46); Emit8(register_offset[A]);	// mov [r14 + a], al
+	}
+	EmitStoreFlags();
+}
+
+// INR and DCR on a register, carry unchanged
+void EmitIncrement(int destination, bool decrement)
+{
+	Emit8(0x41); Emit8(0x0F); Emit8(0xB6); Emit8(0x46); Emit8(register_offset[destination]);	// movzx eax, byte [r14 + dst]
+	Emit8(0x89); Emit8(0xC2);				// mov edx, eax
+	Emit8(0x83); Emit8(decrement ? 0xE8 : 0xC0); Emit8(0x01);	// sub/add eax, 1
+	Emit8(0x31); Emit8(0xC2);				// xor edx, eax
+	Emit8(0x83); Emit8(0xE2); Emit8(FLAG_AC);	// and edx, FLAG_AC
+	if (decrement)
+	{
+		Emit8(0x83); Emit8(0xF2); Emit8(FLAG_AC);	// xor edx, FLAG_AC
+	}
+	Emit8(0x0F); Emit8(0xB6); Emit8(0xC0);	// movzx eax, al
+	Emit8(0x41); Emit8(0x88); Emit8(0x46); Emit8(register_offset[destination]);	// mov [r14 + dst], al
+	Emit8(0x41); Emit8(0x0F); Emit8(0xB6); Emit8(0x4E); Emit8(flags_offset);	// movzx ecx, byte [r14 + flags]
+	Emit8(0x83); Emit8(0xE1); Emit8(FLAG_C);	// and ecx, FLAG_C
+	Emit8(0x09); Emit8(0xCA);				// or edx, ecx
+	EmitStoreFlags();
+}
+
+#endif
+
+// Emits opcode as host instructions if it has a native form. Cycle counts
+// match the handlers in opcodes.h.
+bool EmitNative(const Machine &m, u8 opcode, u16 address)
+{
+	int ddd = (opcode & 0x38) >> 3;
+	int sss = (opcode & 0x07);
+	int rp = (opcode & 0x30) >> 4;
+
+	if (opcode == 0x00)						// NOP
+	{
+		EmitRetire(4);
+		return true;
+	}
+	if ((opcode & 0xC0) == 0x40 && ddd != M && sss != M)	// MOV r,r
+	{
+		Emit8(0x41); Emit8(0x8A); Emit8(0x46); Emit8(register_offset[sss]);	// mov al, [r14 + src]
+		Emit8(0x41); Emit8(0x88); Emit8(0x46); Emit8(register_offset[ddd]);	// mov [r14 + dst], al
+		EmitRetire(5);
+		return true;
+	}
+	if ((opcode & 0xC0) == 0x40 && ddd != M && sss == M)	// MOV r,M
+	{
+		EmitRead(HL);
+		Emit8(0x41); Emit8(0x88); Emit8(0x46); Emit8(register_offset[ddd]);	// mov [r14 + dst], al
+		EmitRetire(7);
+		return true;
+	}
+	if ((opcode & 0xEF) == 0x0A)			// LDAX B, LDAX D
+	{
+		EmitRead(rp);
+		Emit8(0x41); Emit8(0x88); Emit8(0x46); Emit8(register_offset[A]);	// mov [r14 + a], al
+		EmitRetire(7);
+		return true;
+	}
+#ifndef DECODE_CACHE
+	if ((opcode & 0xF8) == 0x70 && sss != M)	// MOV M,r
+	{
+		Emit8(0x41); Emit8(0x0F); Emit8(0xB6); Emit8(0x76); Emit8(register_offset[sss]);	// movzx esi, byte [r14 + src]
+		EmitWrite(HL);
+		EmitRetire(7);
+		return true;
+	}
+	if ((opcode & 0xEF) == 0x02)			// STAX B, STAX D
+	{
+		Emit8(0x41); Emit8(0x0F); Emit8(0xB6); Emit8(0x76); Emit8(register_offset[A]);	// movzx esi, byte [r14 + a]
+		EmitWrite(rp);
+		EmitRetire(7);
+		return true;
+	}
+	if (opcode == 0x36)						// MVI M
+	{
+		Emit8(0xBE); Emit32(mem::Read(m, address + 1));	// mov esi, imm
+		EmitWrite(HL);
+		EmitRetire(10);
+		return true;
+	}
+#endif
+	if ((opcode & 0xC7) == 0x06 && ddd != M)	// MVI r
+	{
+		Emit8(0x41); Emit8(0xC6); Emit8(0x46); Emit8(register_offset[ddd]); Emit8(mem::Read(m, address + 1));	// mov byte [r14 + dst], imm
+		EmitRetire(7);
+		return true;
+	}
+	if ((opcode & 0xCF) == 0x01)			// LXI
+	{
+		u16 value = (mem::Read(m, address + 2) << 8) | mem::Read(m, address + 1);
+		Emit8(0x66); Emit8(0x41); Emit8(0xC7); Emit8(0x46); Emit8(pair_offset[rp]); Emit16(value);	// mov word [r14 + pair], imm
+		EmitRetire(10);
+		return true;
+	}
+	if ((opcode & 0xCF) == 0x03 || (opcode & 0xCF) == 0x0B)	// INX, DCX
+	{
+		Emit8(0x66); Emit8(0x41); Emit8(0xFF); Emit8((opcode & 0x08) ? 0x4E : 0x46); Emit8(pair_offset[rp]);	// inc/dec word [r14 + pair]
+		EmitRetire(5);
+		return true;
+	}
+	if (opcode == 0xEB)						// XCHG
+	{
+		Emit8(0x66); Emit8(0x41); Emit8(0x8B); Emit8(0x46); Emit8(pair_offset[DE]);	// mov ax, [r14 + de]
+		Emit8(0x66); Emit8(0x41); Emit8(0x8B); Emit8(0x4E); Emit8(pair_offset[HL]);	// mov cx, [r14 + hl]
+		Emit8(0x66); Emit8(0x41); Emit8(0x89); Emit8(0x4E); Emit8(pair_offset[DE]);	// mov [r14 + de], cx
+		Emit8(0x66); Emit8(0x41); Emit8(0x89); Emit8(0x46); Emit8(pair_offset[HL]);	// mov [r14 + hl], ax
+		EmitRetire(5);
+		return true;
+	}
+#ifndef LAZY_FLAGS
+	// Flag producing instructions are only emitted for eager flags
+	if ((opcode & 0xC0) == 0x80)			// ALU register or memory
+	{
+		EmitAlu(ddd, sss, false);
+		EmitRetire((sss == M) ? 7 : 4);
+		return true;
+	}
+	if ((opcode & 0xC7) == 0xC6)			// ALU immediate
+	{
+		EmitAlu(ddd, mem::Read(m, address + 1), true);
+		EmitRetire(7);
+		return true;
+	}
+	if ((opcode & 0xC6) == 0x04 && ddd != M)	// INR, DCR
+	{
+		EmitIncrement(ddd, opcode & 0x01);
+		EmitRetire(5);
+		return true;
+	}
+#endif
+	if (opcode == 0x2F)						// CMA
+	{
+		Emit8(0x41); Emit8(0xF6); Emit8(0x56); Emit8(register_offset[A]);	// not byte [r14 + a]
+		EmitRetire(4);
+		return true;
+	}
+	if (opcode == 0xC3)						// JMP
+	{
+		EmitSetPC((mem::Read(m, address + 2) << 8) | mem::Read(m, address + 1));
+		EmitRetire(10);
+		return true;
+	}
+#ifndef LAZY_FLAGS
+	if ((opcode & 0xC7) == 0xC2)			// Jcc: NZ, Z, NC, C, PO, PE, P, M
+	{
+		const u8 condition_flag[4] = { FLAG_Z, FLAG_C, FLAG_P, FLAG_S };
+		EmitSetPC(address + 3);
+		Emit8(0x41); Emit8(0xF6); Emit8(0x46); Emit8(flags_offset); Emit8(condition_flag[ddd >> 1]);	// test byte [r14 + flags], flag
+		Emit8((ddd & 1) ? 0x74 : 0x75);		// jz/jnz over the jump
+		u8 *skip = code_cursor++;
+		EmitSetPC((mem::Read(m, address + 2) << 8) | mem::Read(m, address + 1));
+		*skip = (u8)(code_cursor - skip - 1);
+		EmitRetire(10);
+		return true;
+	}
+#endif
+
+	return false;
+}
+
+// Translates the basic block starting at address, or returns NULL if its
+// first instruction has to go through the interpreter. Blocks only depend on
+// ROM, so they are shared by every Machine running the same one.
+JitBlock Translate(Machine &m, u16 address)
+{
+	if (code_buffer + CODE_BUFFER_SIZE - code_cursor < MAX_BLOCK_BYTES)
+		ResetJit();
+
+	u8 *start = code_cursor;
+	bool pc_synced = true;
+	int count = 0;
+
+	EmitPrologue();
+	while (count < MAX_BLOCK_INSTRUCTIONS)
+	{
+		u8 opcode = mem::Read(m, address);
+		if (address + InstructionLength(opcode) > ROM_SIZE)
+			break;
+
+		if (count > 0)
+			EmitBudgetCheck(address, pc_synced);
+
+		if (EmitNative(m, opcode, address))
+			pc_synced = EndsBlock(opcode);		// only JMP and Jcc, which set PC
+		else
+		{
+			if (!pc_synced)
+				EmitSetPC(address);
+#ifdef DECODE_CACHE
+			DecodeInstruction(m, address);	// the handler reads its operand from here
+#endif
+			EmitHandlerCall(opcode);
+			pc_synced = true;
+		}
+
+		count++;
+		address += InstructionLength(opcode);
+		if (EndsBlock(opcode))
+			break;
+	}
+
+	if (count == 0)
+	{
+		code_cursor = start;
+		return NULL;
+	}
+
+	if (!pc_synced)
+		EmitSetPC(address);
+	EmitEpilogue();
+
+	return (JitBlock)start;
+}
+
+bool InitializeJit()
+{
+	if (code_buffer == NULL)
+	{
+#ifdef _WIN32
+		code_buffer = (u8*)VirtualAlloc(NULL, CODE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+		// Ask for space just below the executable so handler calls fit in a rel32
+		uintptr_t near_code = ((uintptr_t)&InitializeJit & ~(uintptr_t)0xFFFF) - 2 * CODE_BUFFER_SIZE;
+		void *buffer = mmap((void*)near_code, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		code_buffer = (buffer == MAP_FAILED) ? NULL : (u8*)buffer;
+#endif
+		if (code_buffer == NULL)
+			return false;
+	}
+
+	ResetJit();
+	jit_enabled = true;
+	return true;
+}
+
+void ResetJit()
+{
+	code_cursor = code_buffer;
+	memset(block_cache, 0, sizeof(block_cache));
+	memset(untranslatable, 0, sizeof(untranslatable));
+}
+
+int EmulateJit(Machine &m, int cycles)
+{
+	JitContext context = { 0, cycles, 0, &m };
+
+	ResetIdleLoop(m);
+	CheckHalted(m, context.elapsed, context.cycles);
+	while (context.elapsed < context.cycles)
+	{
+		u16 pc = PC;
+		if (pc < ROM_SIZE && !untranslatable[pc])
+		{
+			JitBlock block = block_cache[pc];
+			if (block == NULL)
+			{
+				block = Translate(m, pc);
+				block_cache[pc] = block;
+				untranslatable[pc] = (block == NULL);
+			}
+			if (block != NULL)
+			{
+				block(&context);
+
+				// Only loops of a single block are seen: one that ran whole
+				// and came back to its own start
+				if (PC == pc)
+					CheckIdleLoop(m, pc, context.elapsed, context.instructions, context.cycles);
+				CheckHalted(m, context.elapsed, context.cycles);
+				continue;
+			}
+		}
+
+		// Interpreter fallback: code in RAM and instructions running past the end of ROM
+		context.elapsed += ExecuteInstruction(m);
+		context.instructions++;
+		CheckHalted(m, context.elapsed, context.cycles);
+	}
+
+	m.cycles += context.elapsed;
+	return context.instructions;
+}
+
+#else
+
+bool InitializeJit()
+{
+	return false;
+}
+
+void ResetJit()
+{
+}
+
+int EmulateJit(Machine &m, int cycles)
+{
+	int elapsed_cycles = 0;
+	int instructions = 0;
+
+	CheckHalted(m, elapsed_cycles, cycles);
+	while (elapsed_cycles < cycles)
+	{
+		elapsed_cycles += ExecuteInstruction(m);
+		instructions++;
+		CheckHalted(m, elapsed_cycles, cycles);
+	}
+
+	m.cycles += elapsed_cycles;
+	return instructions;
+}
+
+#endif
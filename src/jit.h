@@ -0,0 +1,25 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "common.h"
+#include "machine.h"
+
+// Optional x86-64 backend translating 8080 basic blocks in ROM into host
+// code. Blocks call the interpreter's handlers for anything not emitted
+// natively and check the cycle budget after every instruction, so timing
+// and results match the interpreter exactly.
+
+// True once InitializeJit() succeeded; Emulate8080() then runs through EmulateJit()
+extern bool jit_enabled;
+
+// Allocates the code buffer; returns false on hosts without the backend
+bool InitializeJit();
+
+// Drops every translated block; call after loading a different ROM. Blocks
+// are shared by all machines, so they must all run the same ROM.
+void ResetJit();
+
+// Same contract as Emulate8080()
+int EmulateJit(Machine &m, int cycles);
+
+#endif /*JIT_H*/
@@ -0,0 +1,600 @@
+#include "lockstep.h"
+#include "dispatch.h"
+#include "processor.h"
+#include "idle.h"
+
+#include <cstring>
+
+static_assert(LOCKSTEP_LANES == 8 || LOCKSTEP_LANES == 16 || LOCKSTEP_LANES == 32, "LOCKSTEP_LANES must be 8, 16 or 32");
+
+/********** Vector operations on 16-bit lanes **********/
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define VECTOR_LANES 16
+typedef __m256i Vec;
+
+inline Vec Load(const u16 *p) { return _mm256_load_si256((const Vec*)p); }
+inline void Store(u16 *p, Vec v) { _mm256_store_si256((Vec*)p, v); }
+inline Vec Set(int x) { return _mm256_set1_epi16((short)x); }
+inline Vec Add(Vec a, Vec b) { return _mm256_add_epi16(a, b); }
+inline Vec Sub(Vec a, Vec b) { return _mm256_sub_epi16(a, b); }
+inline Vec And(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+inline Vec Or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+inline Vec Xor(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+inline Vec AndNot(Vec a, Vec b) { return _mm256_andnot_si256(a, b); }	// ~a & b
+inline Vec Equal(Vec a, Vec b) { return _mm256_cmpeq_epi16(a, b); }
+template <int N> inline Vec ShiftLeft(Vec v) { return _mm256_slli_epi16(v, N); }
+template <int N> inline Vec ShiftRight(Vec v) { return _mm256_srli_epi16(v, N); }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+#include <emmintrin.h>
+
+#define VECTOR_LANES 8
+typedef __m128i Vec;
+
+inline Vec Load(const u16 *p) { return _mm_load_si128((const Vec*)p); }
+inline void Store(u16 *p, Vec v) { _mm_store_si128((Vec*)p, v); }
+inline Vec Set(int x) { return _mm_set1_epi16((short)x); }
+inline Vec Add(Vec a, Vec b) { return _mm_add_epi16(a, b); }
+inline Vec Sub(Vec a, Vec b) { return _mm_sub_epi16(a, b); }
+inline Vec And(Vec a, Vec b) { return _mm_and_si128(a, b); }
+inline Vec Or(Vec a, Vec b) { return _mm_or_si128(a, b); }
+inline Vec Xor(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+inline Vec AndNot(Vec a, Vec b) { return _mm_andnot_si128(a, b); }	// ~a & b
+inline Vec Equal(Vec a, Vec b) { return _mm_cmpeq_epi16(a, b); }
+template <int N> inline Vec ShiftLeft(Vec v) { return _mm_slli_epi16(v, N); }
+template <int N> inline Vec ShiftRight(Vec v) { return _mm_srli_epi16(v, N); }
+
+#else
+
+// Portable stand-in with the same interface
+#define VECTOR_LANES 8
+struct Vec { u16 lane[VECTOR_LANES]; };
+
+#define LANEWISE(expression) Vec v; for (int i = 0; i < VECTOR_LANES; i++) v.lane[i] = (u16)(expression); return v;
+
+inline Vec Load(const u16 *p) { Vec v; memcpy(v.lane, p, sizeof(v.lane)); return v; }
+inline void Store(u16 *p, Vec v) { memcpy(p, v.lane, sizeof(v.lane)); }
+inline Vec Set(int x) { LANEWISE(x) }
+inline Vec Add(Vec a, Vec b) { LANEWISE(a.lane[i] + b.lane[i]) }
+inline Vec Sub(Vec a, Vec b) { LANEWISE(a.lane[i] - b.lane[i]) }
+inline Vec And(Vec a, Vec b) { LANEWISE(a.lane[i] & b.lane[i]) }
+inline Vec Or(Vec a, Vec b) { LANEWISE(a.lane[i] | b.lane[i]) }
+inline Vec Xor(Vec a, Vec b) { LANEWISE(a.lane[i] ^ b.lane[i]) }
+inline Vec AndNot(Vec a, Vec b) { LANEWISE(~a.lane[i] & b.lane[i]) }
+inline Vec Equal(Vec a, Vec b) { LANEWISE((a.lane[i] == b.lane[i]) ? 0xFFFF : 0) }
+template <int N> inline Vec ShiftLeft(Vec a) { LANEWISE(a.lane[i] << N) }
+template <int N> inline Vec ShiftRight(Vec a) { LANEWISE(a.lane[i] >> N) }
+
+#endif
+
+// a where mask is set, b elsewhere
+inline Vec Select(Vec mask, Vec a, Vec b)
+{
+	return Or(And(mask, a), AndNot(mask, b));
+}
+
+#define FOR_EACH_VECTOR(i) for (int i = 0; i < LOCKSTEP_LANES; i += VECTOR_LANES)
+#define FOR_EACH_LANE(lane) for (int lane = 0; lane < LOCKSTEP_LANES; lane++) if (g.mask[lane])
+
+/********** Lane state **********/
+
+void LoadLane(LockstepGroup &g, int lane)
+{
+	Machine &m = *g.machines[lane];
+	g.r[B][lane] = m.cpu.b;
+	g.r[C][lane] = m.cpu.c;
+	g.r[D][lane] = m.cpu.d;
+	g.r[E][lane] = m.cpu.e;
+	g.r[H][lane] = m.cpu.h;
+	g.r[L][lane] = m.cpu.l;
+	g.r[A][lane] = m.cpu.a;
+	g.flags[lane] = GetStatusByte(m);
+	g.pc[lane] = m.cpu.pc;
+	g.sp[lane] = m.cpu.sp;
+}
+
+void StoreLane(LockstepGroup &g, int lane)
+{
+	Machine &m = *g.machines[lane];
+	m.cpu.b = (u8)g.r[B][lane];
+	m.cpu.c = (u8)g.r[C][lane];
+	m.cpu.d = (u8)g.r[D][lane];
+	m.cpu.e = (u8)g.r[E][lane];
+	m.cpu.h = (u8)g.r[H][lane];
+	m.cpu.l = (u8)g.r[L][lane];
+	m.cpu.a = (u8)g.r[A][lane];
+	SetStatusBits(m, (u8)g.flags[lane]);
+	m.cpu.pc = g.pc[lane];
+	m.cpu.sp = g.sp[lane];
+}
+
+void LoadLanes(LockstepGroup &g, Machine *const *machines)
+{
+	for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+	{
+		g.machines[lane] = machines[lane];
+		LoadLane(g, lane);
+	}
+}
+
+void StoreLanes(LockstepGroup &g)
+{
+	for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+		StoreLane(g, lane);
+}
+
+// Waits out the budget of a halted lane; spin loops are not skipped here
+inline void CheckHaltedLane(LockstepGroup &g, int lane, int cycles)
+{
+	int elapsed = g.elapsed[lane];
+	CheckHalted(*g.machines[lane], elapsed, cycles);
+	g.elapsed[lane] = (u16)elapsed;
+}
+
+// Runs one instruction of a lane through the interpreter
+void StepLane(LockstepGroup &g, int lane, int cycles)
+{
+	StoreLane(g, lane);
+	g.elapsed[lane] += ExecuteInstruction(*g.machines[lane]);
+	CheckHaltedLane(g, lane, cycles);
+	LoadLane(g, lane);
+}
+
+/********** Kernels **********/
+
+// Writes value into the lanes of the current step
+inline void Update(LockstepGroup &g, u16 *registers, int i, Vec value)
+{
+	Store(registers + i, Select(Load(g.mask + i), value, Load(registers + i)));
+}
+
+inline void Advance(LockstepGroup &g, int length)
+{
+	FOR_EACH_VECTOR(i)
+		Update(g, g.pc, i, Add(Load(g.pc + i), Set(length)));
+}
+
+inline Vec GetPair(const LockstepGroup &g, int rp, int i)
+{
+	if (rp == SP_PAIR)
+		return Load(g.sp + i);
+	return Or(ShiftLeft<8>(Load(g.r[rp * 2] + i)), Load(g.r[rp * 2 + 1] + i));
+}
+
+inline void SetPair(LockstepGroup &g, int rp, int i, Vec value)
+{
+	if (rp == SP_PAIR)
+		Update(g, g.sp, i, value);
+	else
+	{
+		Update(g, g.r[rp * 2], i, ShiftRight<8>(value));
+		Update(g, g.r[rp * 2 + 1], i, And(value, Set(0xFF)));
+	}
+}
+
+inline u16 LanePair(const LockstepGroup &g, int rp, int lane)
+{
+	return (rp == SP_PAIR) ? g.sp[lane] : (u16)((g.r[rp * 2][lane] << 8) | g.r[rp * 2 + 1][lane]);
+}
+
+inline void LanePush(LockstepGroup &g, int lane, u16 value)
+{
+	Machine &m = *g.machines[lane];
+	mem::Write(m, g.sp[lane] - 1, value >> 8);
+	mem::Write(m, g.sp[lane] - 2, value & 0xFF);
+	g.sp[lane] -= 2;
+}
+
+inline u16 LanePop(LockstepGroup &g, int lane)
+{
+	Machine &m = *g.machines[lane];
+	u16 value = (mem::Read(m, g.sp[lane] + 1) << 8) | mem::Read(m, g.sp[lane]);
+	g.sp[lane] += 2;
+	return value;
+}
+
+// Flag tested by each pair of conditions in the Jcc, Ccc and Rcc opcodes:
+// NZ and Z, NC and C, PO and PE, P and M
+const u8 condition_flag[4] = { FLAG_Z, FLAG_C, FLAG_P, FLAG_S };
+
+inline bool Condition(u16 flags, int ccc)
+{
+	return ((flags & condition_flag[ccc >> 1]) != 0) == (ccc & 1);
+}
+
+// Fetches the byte at HL of every lane into r[M]
+inline void FetchM(LockstepGroup &g)
+{
+	FOR_EACH_LANE(lane)
+		g.r[M][lane] = mem::Read(*g.machines[lane], LanePair(g, HL, lane));
+}
+
+// Writes r[M] of every lane to its HL
+inline void StoreM(LockstepGroup &g)
+{
+	FOR_EACH_LANE(lane)
+		mem::Write(*g.machines[lane], LanePair(g, HL, lane), (u8)g.r[M][lane]);
+}
+
+// S, Z and P of result bytes, plus the bit that always reads 1
+inline Vec SignZeroParity(Vec result)
+{
+	Vec parity = Xor(result, ShiftRight<4>(result));
+	parity = Xor(parity, ShiftRight<2>(parity));
+	parity = Xor(parity, ShiftRight<1>(parity));
+	Vec even = ShiftLeft<2>(AndNot(parity, Set(1)));
+	Vec zero = And(Equal(result, Set(0)), Set(FLAG_Z));
+	return Or(Or(And(result, Set(FLAG_S)), zero), Or(even, Set(FLAG_1)));
+}
+
+// ADD, ADC, SUB, SBB, ANA, XRA, ORA or CMP of b with A. AC comes out of
+// (a ^ b ^ result) & 0x10, which matches the aux carry tables.
+void Alu(LockstepGroup &g, int operation, int i, Vec b)
+{
+	Vec a = Load(g.r[A] + i);
+	Vec carry_in = And(Load(g.flags + i), Set(FLAG_C));
+	Vec result, carry = Set(0), aux = Set(0);
+
+	switch (operation)
+	{
+	case 0: case 1:				// ADD, ADC
+		result = Add(a, b);
+		if (operation == 1)
+			result = Add(result, carry_in);
+		carry = ShiftRight<8>(result);
+		aux = And(Xor(Xor(a, b), result), Set(FLAG_AC));
+		break;
+	case 2: case 3: case 7:		// SUB, SBB, CMP
+		result = Sub(a, b);
+		if (operation == 3)
+			result = Sub(result, carry_in);
+		carry = And(ShiftRight<8>(result), Set(FLAG_C));
+		aux = AndNot(Xor(Xor(a, b), result), Set(FLAG_AC));
+		break;
+	case 4:						// ANA
+		result = And(a, b);
+		aux = ShiftLeft<1>(And(Or(a, b), Set(0x08)));
+		break;
+	case 5:						// XRA
+		result = Xor(a, b);
+		break;
+	default:					// ORA
+		result = Or(a, b);
+		break;
+	}
+
+	result = And(result, Set(0xFF));
+	if (operation != 7)
+		Update(g, g.r[A], i, result);
+	Update(g, g.flags, i, Or(Or(SignZeroParity(result), aux), carry));
+}
+
+// INR or DCR of r[ddd]; carry is left alone
+void IncrementDecrement(LockstepGroup &g, int ddd, int i, bool decrement)
+{
+	Vec value = Load(g.r[ddd] + i);
+	Vec result = And(decrement ? Sub(value, Set(1)) : Add(value, Set(1)), Set(0xFF));
+	Vec aux = And(Xor(Xor(value, Set(1)), result), Set(FLAG_AC));
+	if (decrement)
+		aux = Xor(aux, Set(FLAG_AC));
+
+	Update(g, g.r[ddd], i, result);
+	Update(g, g.flags, i, Or(Or(SignZeroParity(result), aux), And(Load(g.flags + i), Set(FLAG_C))));
+}
+
+// Rotates A: RLC, RRC, RAL or RAR
+void Rotate(LockstepGroup &g, int operation, int i)
+{
+	Vec a = Load(g.r[A] + i);
+	Vec flags = Load(g.flags + i);
+	Vec carry_in = And(flags, Set(FLAG_C));
+	Vec left = ShiftRight<7>(a), right = And(a, Set(1));
+	Vec result, carry;
+
+	switch (operation)
+	{
+	case 0: result = Or(ShiftLeft<1>(a), left); carry = left; break;				// RLC
+	case 1: result = Or(ShiftRight<1>(a), ShiftLeft<7>(right)); carry = right; break;	// RRC
+	case 2: result = Or(ShiftLeft<1>(a), carry_in); carry = left; break;			// RAL
+	default: result = Or(ShiftRight<1>(a), ShiftLeft<7>(carry_in)); carry = right; break;	// RAR
+	}
+
+	Update(g, g.r[A], i, And(result, Set(0xFF)));
+	Update(g, g.flags, i, Or(AndNot(Set(FLAG_C), flags), carry));
+}
+
+// Runs the opcode at address on the lanes of the current step. Returns its
+// cycles, or 0 if it has no kernel and must go through the interpreter.
+int ExecuteKernel(LockstepGroup &g, const Machine &lead, u16 address)
+{
+	u8 opcode = mem::Read(lead, address);
+	u8 byte = mem::Read(lead, address + 1);
+	u16 word = (mem::Read(lead, address + 2) << 8) | byte;
+	int ddd = (opcode >> 3) & 7;
+	int sss = opcode & 7;
+	int rp = (opcode >> 4) & 3;
+
+	// MOV
+	if ((opcode & 0xC0) == 0x40 && opcode != 0x76)
+	{
+		if (sss == M)
+			FetchM(g);
+		FOR_EACH_VECTOR(i)
+			Update(g, g.r[ddd], i, Load(g.r[sss] + i));
+		if (ddd == M)
+			StoreM(g);
+		Advance(g, 1);
+		return (sss == M || ddd == M) ? 7 : 5;
+	}
+
+	// ALU with a register or memory
+	if ((opcode & 0xC0) == 0x80)
+	{
+		if (sss == M)
+			FetchM(g);
+		FOR_EACH_VECTOR(i)
+			Alu(g, ddd, i, Load(g.r[sss] + i));
+		Advance(g, 1);
+		return (sss == M) ? 7 : 4;
+	}
+
+	switch (opcode & 0xC7)
+	{
+	case 0xC6:					// ALU immediate
+		FOR_EACH_VECTOR(i)
+			Alu(g, ddd, i, Set(byte));
+		Advance(g, 2);
+		return 7;
+	case 0x06:					// MVI
+		FOR_EACH_VECTOR(i)
+			Update(g, g.r[ddd], i, Set(byte));
+		if (ddd == M)
+			StoreM(g);
+		Advance(g, 2);
+		return (ddd == M) ? 10 : 7;
+	case 0x04: case 0x05:		// INR, DCR
+		if (ddd == M)
+			FetchM(g);
+		FOR_EACH_VECTOR(i)
+			IncrementDecrement(g, ddd, i, opcode & 1);
+		if (ddd == M)
+			StoreM(g);
+		Advance(g, 1);
+		return (ddd == M) ? 10 : 5;
+	case 0xC2:					// Jcc
+		FOR_EACH_VECTOR(i)
+		{
+			Vec clear = Equal(And(Load(g.flags + i), Set(condition_flag[ddd >> 1])), Set(0));
+			Vec taken = (ddd & 1) ? AndNot(clear, Set(0xFFFF)) : clear;
+			Update(g, g.pc, i, Select(taken, Set(word), Add(Load(g.pc + i), Set(3))));
+		}
+		return 10;
+	case 0xC4:					// Ccc
+		FOR_EACH_LANE(lane)
+		{
+			if (Condition(g.flags[lane], ddd))
+			{
+				LanePush(g, lane, g.pc[lane] + 3);
+				g.pc[lane] = word;
+			}
+			else
+				g.pc[lane] += 3;
+		}
+		return 17;
+	case 0xC0:					// Rcc
+		FOR_EACH_LANE(lane)
+			g.pc[lane] = Condition(g.flags[lane], ddd) ? LanePop(g, lane) : g.pc[lane] + 1;
+		return 11;
+	}
+
+	switch (opcode & 0xCF)
+	{
+	case 0x01:					// LXI
+		FOR_EACH_VECTOR(i)
+			SetPair(g, rp, i, Set(word));
+		Advance(g, 3);
+		return 10;
+	case 0x03: case 0x0B:		// INX, DCX
+		FOR_EACH_VECTOR(i)
+			SetPair(g, rp, i, (opcode & 0x08) ? Sub(GetPair(g, rp, i), Set(1)) : Add(GetPair(g, rp, i), Set(1)));
+		Advance(g, 1);
+		return 5;
+	case 0x09:					// DAD
+		FOR_EACH_VECTOR(i)
+		{
+			Vec hl = GetPair(g, HL, i), pair = GetPair(g, rp, i);
+			Vec sum = Add(hl, pair);
+			Vec carry = ShiftRight<15>(Or(And(hl, pair), AndNot(sum, Or(hl, pair))));
+			SetPair(g, HL, i, sum);
+			Update(g, g.flags, i, Or(AndNot(Set(FLAG_C), Load(g.flags + i)), carry));
+		}
+		Advance(g, 1);
+		return 10;
+	case 0x02:					// STAX B, STAX D
+		if (rp > DE)
+			break;
+		FOR_EACH_LANE(lane)
+			mem::Write(*g.machines[lane], LanePair(g, rp, lane), (u8)g.r[A][lane]);
+		Advance(g, 1);
+		return 7;
+	case 0x0A:					// LDAX B, LDAX D
+		if (rp > DE)
+			break;
+		FOR_EACH_LANE(lane)
+			g.r[A][lane] = mem::Read(*g.machines[lane], LanePair(g, rp, lane));
+		Advance(g, 1);
+		return 7;
+	case 0xC5:					// PUSH
+		FOR_EACH_LANE(lane)
+			LanePush(g, lane, (rp == PSW) ? (u16)((g.r[A][lane] << 8) | g.flags[lane]) : LanePair(g, rp, lane));
+		Advance(g, 1);
+		return 11;
+	case 0xC1:					// POP
+		FOR_EACH_LANE(lane)
+		{
+			u16 value = LanePop(g, lane);
+			if (rp == PSW)
+			{
+				g.r[A][lane] = value >> 8;
+				g.flags[lane] = (value & (FLAG_S | FLAG_Z | FLAG_AC | FLAG_P | FLAG_C)) | FLAG_1;
+			}
+			else
+			{
+				g.r[rp * 2][lane] = value >> 8;
+				g.r[rp * 2 + 1][lane] = value & 0xFF;
+			}
+		}
+		Advance(g, 1);
+		return 10;
+	}
+
+	switch (opcode)
+	{
+	case 0x00:					// NOP
+		Advance(g, 1);
+		return 4;
+	case 0x07: case 0x0F: case 0x17: case 0x1F:	// RLC, RRC, RAL, RAR
+		FOR_EACH_VECTOR(i)
+			Rotate(g, ddd, i);
+		Advance(g, 1);
+		return 4;
+	case 0x2F:					// CMA
+		FOR_EACH_VECTOR(i)
+			Update(g, g.r[A], i, Xor(Load(g.r[A] + i), Set(0xFF)));
+		Advance(g, 1);
+		return 4;
+	case 0x37: case 0x3F:		// STC, CMC
+		FOR_EACH_VECTOR(i)
+		{
+			Vec flags = Load(g.flags + i);
+			Update(g, g.flags, i, (opcode == 0x37) ? Or(flags, Set(FLAG_C)) : Xor(flags, Set(FLAG_C)));
+		}
+		Advance(g, 1);
+		return 4;
+	case 0xEB:					// XCHG
+		FOR_EACH_VECTOR(i)
+		{
+			Vec de = GetPair(g, DE, i);
+			SetPair(g, DE, i, GetPair(g, HL, i));
+			SetPair(g, HL, i, de);
+		}
+		Advance(g, 1);
+		return 5;
+	case 0x32:					// STA
+		FOR_EACH_LANE(lane)
+			mem::Write(*g.machines[lane], word, (u8)g.r[A][lane]);
+		Advance(g, 3);
+		return 13;
+	case 0x3A:					// LDA
+		FOR_EACH_LANE(lane)
+			g.r[A][lane] = mem::Read(*g.machines[lane], word);
+		Advance(g, 3);
+		return 13;
+	case 0xC3:					// JMP
+		FOR_EACH_VECTOR(i)
+			Update(g, g.pc, i, Set(word));
+		return 10;
+	case 0xCD:					// CALL
+		FOR_EACH_LANE(lane)
+		{
+			LanePush(g, lane, g.pc[lane] + 3);
+			g.pc[lane] = word;
+		}
+		return 17;
+	case 0xC9:					// RET
+		FOR_EACH_LANE(lane)
+			g.pc[lane] = LanePop(g, lane);
+		return 10;
+	}
+
+	return 0;
+}
+
+/********** Stepping **********/
+
+// Steps until every lane's elapsed count has reached cycles
+static long long RunLanes(LockstepGroup &g, int cycles)
+{
+	long long instructions = 0;
+
+	for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+		CheckHaltedLane(g, lane, cycles);
+
+	for (;;)
+	{
+		// The lowest PC with budget left goes next, so lanes that took
+		// different branches meet again where the paths join
+		int target = 0x10000;
+		for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+			if (g.elapsed[lane] < cycles && g.pc[lane] < target)
+				target = g.pc[lane];
+		if (target == 0x10000)
+			return instructions;
+
+		int count = 0;
+		int lead = 0;
+		for (int lane = LOCKSTEP_LANES - 1; lane >= 0; lane--)
+		{
+			bool taking_part = (g.elapsed[lane] < cycles && g.pc[lane] == target);
+			g.mask[lane] = taking_part ? 0xFFFF : 0;
+			if (taking_part)
+			{
+				count++;
+				lead = lane;
+			}
+		}
+
+		// Opcodes in ROM are the same in every lane
+		int step_cycles = (target < ROM_SIZE) ? ExecuteKernel(g, *g.machines[lead], target) : 0;
+		if (step_cycles > 0)
+		{
+			FOR_EACH_VECTOR(i)
+				Store(g.elapsed + i, Add(Load(g.elapsed + i), And(Load(g.mask + i), Set(step_cycles))));
+			g.vector_instructions += count;
+		}
+		else
+		{
+			FOR_EACH_LANE(lane)
+				StepLane(g, lane, cycles);
+			g.scalar_instructions += count;
+		}
+		instructions += count;
+	}
+}
+
+long long EmulateLockstep(LockstepGroup &g, int cycles)
+{
+	memset(g.elapsed, 0, sizeof(g.elapsed));
+	long long instructions = RunLanes(g, cycles);
+	for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+		g.machines[lane]->cycles += g.elapsed[lane];
+	return instructions;
+}
+
+long long EmulateLockstepHalfFrame(LockstepGroup &g)
+{
+	// Each lane starts as far into the half frame as its last instruction
+	// overshot the previous one
+	u16 start[LOCKSTEP_LANES];
+	for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+		g.elapsed[lane] = start[lane] = (u16)(g.machines[lane]->cycles % HALF_FRAME_CYCLES);
+
+	long long instructions = RunLanes(g, HALF_FRAME_CYCLES);
+	for (int lane = 0; lane < LOCKSTEP_LANES; lane++)
+	{
+		Machine &m = *g.machines[lane];
+		m.cycles += g.elapsed[lane] - start[lane];
+		if (m.cpu.INTE)
+		{
+			StoreLane(g, lane);
+			EndHalfFrame(m);
+			LoadLane(g, lane);
+		}
+	}
+	return instructions;
+}
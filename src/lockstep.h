@@ -0,0 +1,48 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "common.h"
+#include "machine.h"
+
+// Experimental lockstep core: the registers of LOCKSTEP_LANES machines are
+// kept in structure-of-arrays form, one 16-bit lane per machine, and every
+// step executes one opcode on all lanes whose PC is the lowest outstanding
+// one. Register, ALU and branch opcodes in ROM run as SSE2/AVX2 kernels over
+// the whole group, memory and stack opcodes loop over the lanes, anything
+// else goes through the interpreter one lane at a time. Lanes that diverge
+// wait at their PC until the lanes behind catch up, so each machine runs
+// exactly the instructions it would run alone. All lanes must run the same
+// ROM. Like the JIT, the core bypasses the profiler hooks.
+
+#ifndef LOCKSTEP_LANES
+#define LOCKSTEP_LANES 16		// 8, 16 or 32
+#endif
+
+struct alignas(64) LockstepGroup
+{
+	u16 r[8][LOCKSTEP_LANES];	// indexed by the SSS/DDD field; r[M] holds the memory operand of the current step
+	u16 flags[LOCKSTEP_LANES];	// PSW layout, always eager
+	u16 pc[LOCKSTEP_LANES];
+	u16 sp[LOCKSTEP_LANES];
+	u16 elapsed[LOCKSTEP_LANES];	// cycles run in the current EmulateLockstep() call
+	u16 mask[LOCKSTEP_LANES];	// 0xFFFF for the lanes taking part in the current step
+	Machine *machines[LOCKSTEP_LANES];
+
+	long long vector_instructions;	// lane instructions run by the kernels
+	long long scalar_instructions;	// and by the interpreter
+};
+
+// Attaches one machine to every lane and copies its registers in
+void LoadLanes(LockstepGroup &g, Machine *const *machines);
+
+// Copies the lane registers back into their machines
+void StoreLanes(LockstepGroup &g);
+
+// Runs every lane for at least cycles cycles (below 0x7F00) and adds them
+// to its machine's count; returns the instructions executed over all lanes
+long long EmulateLockstep(LockstepGroup &g, int cycles);
+
+// EmulateHalfFrame() for every lane
+long long EmulateLockstepHalfFrame(LockstepGroup &g);
+
+#endif /*LOCKSTEP_H*/
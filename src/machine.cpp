@@ -0,0 +1,58 @@
+#include "machine.h"
+#include "processor.h"
+
+#include <cstring>
+
+// Unmapped pages read as zero
+const u8 unmapped_page[0x100] = {};
+
+void InitializeMachine(Machine &m)
+{
+	memset(&m, 0, sizeof(m));
+	m.rom = m.memory;
+	MapMemory(m);
+	InitializeCPU(m);
+	m.running = true;
+}
+
+void MapMemory(Machine &m)
+{
+	for (int page = 0; page < 0x100; page++)
+	{
+		int address = page << 8;
+		if (address < ROM_SIZE)
+		{
+			m.read_pages[page] = m.rom + address;
+			m.write_pages[page] = NULL;
+		}
+		else if (address < RAM_START + 2 * RAM_SIZE)
+		{
+			// RAM, then its mirror
+			u8 *storage = m.memory + RAM_START + ((address - RAM_START) & (RAM_SIZE - 1));
+			m.read_pages[page] = storage;
+			m.write_pages[page] = storage;
+		}
+		else
+		{
+			m.read_pages[page] = unmapped_page;
+			m.write_pages[page] = NULL;
+		}
+	}
+}
+
+void CopyMachine(Machine &to, const Machine &from)
+{
+	memcpy(&to, &from, sizeof(Machine));
+	if (from.rom == from.memory)
+		to.rom = to.memory;
+	MapMemory(to);
+}
+
+void UnshareRom(Machine &m)
+{
+	if (m.rom == m.memory)
+		return;
+	memcpy(m.memory, m.rom, ROM_SIZE);
+	m.rom = m.memory;
+	MapMemory(m);
+}
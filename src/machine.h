@@ -0,0 +1,118 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include "common.h"
+#include "decode.h"
+
+// Declares the two bytes of a register pair in host memory order so that
+// the 8-bit registers alias the high and low halves of the 16-bit pair
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define PAIR_BYTES(high, low) u8 high, low
+#else
+#define PAIR_BYTES(high, low) u8 low, high
+#endif
+
+struct alignas(64) state
+{
+	union { u16 bc; struct { PAIR_BYTES(b, c); }; };
+	union { u16 de; struct { PAIR_BYTES(d, e); }; };
+	union { u16 hl; struct { PAIR_BYTES(h, l); }; };
+	union { u16 psw; struct { PAIR_BYTES(a, flags); }; };	// flags in PSW layout: S-Z-0-AC-0-P-1-C
+	u16 pc;				// program counter
+	u16 sp;				// stack pointer
+	bool IE;
+
+	bool INTE;
+#ifdef LAZY_FLAGS
+	u8 lazy_op;			// last flag-setting operation, FLAG_OP_NONE once status is current
+	u8 lazy_a, lazy_b;	// its operands
+	u8 lazy_result;		// and its result
+#endif
+};
+static_assert(sizeof(state) == 64, "CPU state should fill exactly one cache line");
+
+// Memory map: ROM at 0x0000, RAM at 0x2000, a mirror of RAM at 0x4000 and
+// nothing above 0x6000. Machine::memory holds ROM and RAM, though ROM may
+// also be read from an image shared between machines; the page tables
+// route every 256-byte page of the address space to its storage.
+#define ROM_SIZE 0x2000
+#define RAM_START ROM_SIZE
+#define RAM_SIZE 0x2000
+#define MEMORY_SIZE (RAM_START + RAM_SIZE)
+
+// Spin-loop tracking for the cores (idle.h): where the last backward jump
+// they saw landed, and the machine as it was there once the loop looked idle
+struct IdleLoop
+{
+	u16 pc;
+	long long writes;
+	u64 registers;			// BC, DE, HL and PSW, the first bytes of state
+	bool seen;				// the above hold; false until the first such jump of the call
+	state cpu;
+	u16 shift_register;
+	u16 shift_offset;
+	int elapsed;			// cycles and instructions into the current Emulate8080() call
+	int instructions;
+	bool valid;				// the rest holds; false until the loop came round without writing
+};
+
+// Bits of Machine::dirty_pages, each cleared by its own consumer
+#define DIRTY_REWIND 0x01
+#define DIRTY_VIDEO 0x02
+
+// One Space Invaders machine: CPU, memory and the I/O hardware. The core
+// only touches state through a Machine, so any number of them can run side
+// by side in one process. The page tables point into the machine itself,
+// so copies must be made with CopyMachine().
+struct Machine
+{
+	state cpu;				// first, so code holding a Machine pointer also holds the CPU state
+	u8 memory[MEMORY_SIZE];
+	const u8 *rom;					// ROM storage: memory itself, or a shared read-only image
+	const u8 *read_pages[0x100];	// storage each page reads from
+	u8 *write_pages[0x100];			// and writes to; NULL where writes are dropped (ROM, unmapped)
+	long long dropped_writes;		// writes to ROM or unmapped pages
+	long long writes;				// the others, for telling loops that change nothing
+	u8 dirty_pages[MEMORY_SIZE >> 8];	// one bit per consumer of writes (DIRTY_*), all set by mem::Write
+
+	// I/O hardware
+	u8 dipswitch_1;
+	u8 dipswitch_2;
+	u16 shift_register;
+	u16 shift_offset;
+
+	long long cycles;		// run since power-on; the interrupts and every scheduled event are timed by it
+	bool running;			// the run loops stop when this is cleared
+	bool halted;			// set by HLT until the next interrupt
+
+	IdleLoop idle;
+	long long skipped_cycles;	// credited without running: spin loops and HLT
+
+#ifdef DECODE_CACHE
+	DecodedInstruction decode_cache[0x10000];
+	bool decoded_pages[0x100];	// pages holding bytes of a decoded instruction
+#endif
+};
+
+// Clears the whole machine, memory included, and powers it on
+void InitializeMachine(Machine &m);
+
+// Fills in the page tables
+void MapMemory(Machine &m);
+
+// Copies from into to, page tables pointing at to's own memory; a shared
+// ROM image stays shared
+void CopyMachine(Machine &to, const Machine &from);
+
+// Gives a machine running a shared ROM image its own copy in memory, so
+// the ROM can be changed
+void UnshareRom(Machine &m);
+
+// Where a page is stored when it is neither shared nor mirrored; only
+// bytes read from there can be cached by address
+inline const u8 *HomePage(const Machine &m, int page)
+{
+	return (page < (ROM_SIZE >> 8) ? m.rom : m.memory) + (page << 8);
+}
+
+#endif /*MACHINE_H*/
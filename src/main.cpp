@@ -1,25 +1,80 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#ifndef NO_SDL
 #include <SDL2/SDL.h>
 #undef main
+#endif
 
 #include "processor.h"
-#include "opcodes.h"
+#include "batch.h"
+#include "dispatch.h"
+#include "input.h"
+#include "jit.h"
+#include "machine.h"
 #include "memory.h"
+#include "movie.h"
+#include "rom.h"
+#include "savestate.h"
+#include "scheduler.h"
+#include "video.h"
 
-#define WIDTH 224
-#define HEIGHT 256
 #define SCALE 3
+#define REFRESH_RATE 60		// presents per second
+#define INPUT_POLL_CYCLES (CLOCK_RATE / 1000)	// the machine takes in input and waits for real time every 1 ms
 
-#define REG_PAIR ((opcode & 0x30) >> 4)
-#define DDD ((opcode & 0x38) >> 3)
-#define EXP ((opcode & 0x38) >> 3)
-#define SSS (opcode & 0x07)
+Machine machine;
+RomImage rom;
+Movie movie;
 
+// Called as each movie frame starts; reports the end of playback at once
+void StepMovie(Machine &m)
+{
+	if (movie.mode == MOVIE_OFF || MovieFrame(movie, m))
+		return;
+	if (movie.desync_frame >= 0)
+		std::cout << "Movie desync at frame " << movie.desync_frame << "\n";
+	else
+		std::cout << "Movie ended after " << movie.frames << " frames\n";
+}
+
+#ifndef NO_SDL
 
 SDL_Window *window;
 SDL_Surface *surface, *surface_native;
+VideoFrame frame;
+FrameExchange exchange;
+InputExchange input;
+LatencyHistogram latency;
+std::atomic<bool> quit(false);
 
-bool running = true;
+struct KeyBinding
+{
+	SDL_Scancode key;
+	int input;
+};
+
+const KeyBinding default_bindings[] =
+{
+	{ SDL_SCANCODE_C, INPUT_COIN },
+	{ SDL_SCANCODE_1, INPUT_P1_START },
+	{ SDL_SCANCODE_2, INPUT_P2_START },
+	{ SDL_SCANCODE_SPACE, INPUT_P1_FIRE },
+	{ SDL_SCANCODE_LEFT, INPUT_P1_LEFT },
+	{ SDL_SCANCODE_RIGHT, INPUT_P1_RIGHT },
+	{ SDL_SCANCODE_W, INPUT_P2_FIRE },
+	{ SDL_SCANCODE_A, INPUT_P2_LEFT },
+	{ SDL_SCANCODE_D, INPUT_P2_RIGHT },
+	{ SDL_SCANCODE_T, INPUT_TILT },
+};
+
+std::vector<KeyBinding> bindings(default_bindings, default_bindings + sizeof(default_bindings) / sizeof(default_bindings[0]));
 
 bool Initialize()
 {
@@ -30,271 +85,478 @@ bool Initialize()
 	SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 0, 0, 0));
 	SDL_UpdateWindowSurface(window);
 	surface_native = SDL_CreateRGBSurface(0, WIDTH, HEIGHT, 32, 0, 0, 0, 0);
+	if (surface_native == NULL) return false;
+	InitializeVideoFrame(frame, (u32*)surface_native->pixels);
+	InitializeExchange(exchange);
+	InitializeInputExchange(input);
 
 	atexit(SDL_Quit);
 
-	InitializeCPU();
-
 	return true;
 }
 
-bool LoadRom()
+#endif
+
+#ifndef NO_SDL
+
+// Replaces the key bindings with those in a file of lines such as
+// "p1_fire Left Ctrl": an input name, then an SDL key name
+bool LoadBindings(const char *path)
 {
-	int size;
-	char *buffer;
-
-	FILE *f0 = fopen("invaders.h", "rb");
-	FILE *f1 = fopen("invaders.g", "rb");
-	FILE *f2 = fopen("invaders.f", "rb");
-	FILE *f3 = fopen("invaders.e", "rb");
-	if (f0 == NULL || f1 == NULL || f2 == NULL || f3 == NULL)
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
 		return false;
 
-	// Bank 0
-	fseek(f0, 0, 2);
-	size = ftell(f0);
-	fseek(f0, 0, 0);
-	buffer = new char[size];
-	fread(buffer, sizeof(char), size, f0);
-	for (int i = 0; i < 0x800; i++)
-		mem::LoadROM(i, buffer[i]);
-
-	// Bank 1
-	fseek(f1, 0, 2);
-	size = ftell(f1);
-	fseek(f1, 0, 0);
-	buffer = new char[size];
-	fread(buffer, sizeof(char), size, f1);
-	for (int i = 0; i < 0x800; i++)
-		mem::LoadROM(i + 0x800, buffer[i]);
-
-	// Bank 2
-	fseek(f2, 0, 2);
-	size = ftell(f2);
-	fseek(f2, 0, 0);
-	buffer = new char[size];
-	fread(buffer, sizeof(char), size, f2);
-	for (int i = 0; i < 0x800; i++)
-		mem::LoadROM(i + 0x1000, buffer[i]);
-
-	// Bank 3
-	fseek(f3, 0, 2);
-	size = ftell(f3);
-	fseek(f3, 0, 0);
-	buffer = new char[size];
-	fread(buffer, sizeof(char), size, f3);
-	for (int i = 0; i < 0x800; i++)
-		mem::LoadROM(i + 0x1800, buffer[i]);
+	std::vector<KeyBinding> loaded;
+	char line[128], name[32], key[64];
+	bool valid = true;
+	while (valid && fgets(line, sizeof(line), f) != NULL)
+	{
+		if (line[0] == '#' || sscanf(line, "%31s %63[^\r\n]", name, key) < 1)
+			continue;
+		KeyBinding binding = { SDL_GetScancodeFromName(key), FindInput(name) };
+		valid = binding.key != SDL_SCANCODE_UNKNOWN && binding.input >= 0;
+		loaded.push_back(binding);
+	}
+	fclose(f);
 
-	return true;
+	if (valid)
+		bindings = loaded;
+	return valid;
 }
 
-inline void GetInput()
+inline long long Now()
 {
-	SDL_Event e;
-	if (SDL_PollEvent(&e) != 0 && e.type == SDL_QUIT)
-		running = false;
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-	const Uint8 *state = SDL_GetKeyboardState(NULL);
+// Inputs are timed from when SDL queued them, not from when they are handled
+void HandleEvent(const SDL_Event &e)
+{
+	if (e.type == SDL_QUIT)
+		quit = true;
+	else if ((e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) && !e.key.repeat)
+	{
+		long long queued = Now() - (long long)(Uint32)(SDL_GetTicks() - e.key.timestamp) * 1000000;
+		for (const KeyBinding &binding : bindings)
+			if (binding.key == e.key.keysym.scancode)
+				PressInput(input, binding.input, e.type == SDL_KEYDOWN, queued);
+	}
+}
 
-	if (state[SDL_SCANCODE_LEFT])	dipswitch_1 |= 0x20;
-	else							dipswitch_1 &= 0xDF;
+void Draw(const u8 *vram)
+{
+	if (!UpdateFrame(frame, vram))
+		return;
+
+	// Only the strip of columns that changed is scaled and presented
+	SDL_Rect source = { frame.first_changed, 0, frame.last_changed - frame.first_changed + 1, HEIGHT };
+	SDL_Rect target = { source.x * SCALE, 0, source.w * SCALE, HEIGHT * SCALE };
+	SDL_BlitScaled(surface_native, &source, surface, &target);
+	SDL_UpdateWindowSurfaceRects(window, &target, 1);
+}
 
-	if (state[SDL_SCANCODE_RIGHT])	dipswitch_1 |= 0x40;
-	else							dipswitch_1 &= 0xBF;
+// Scheduled at both interrupts: VRAM goes to the display if it was
+// written, tagged with the last input change it reflects
+void HandOffFrame(Machine &m, void *context)
+{
+	if (TakeVideoChanges(m))
+		PublishFrame(*(FrameExchange*)context, m, input.applied);
+}
 
+struct Pacing
+{
+	std::chrono::steady_clock::time_point start;
+	long long start_cycles;
+};
+
+// Scheduled every INPUT_POLL_CYCLES: waits until real time catches up with
+// the machine, then puts the inputs held by then into the ports. Waiting in
+// small steps keeps input from sitting out a whole frame.
+void PollInput(Machine &m, void *context)
+{
+	Pacing &pacing = *(Pacing*)context;
+	auto due = pacing.start + std::chrono::nanoseconds((m.cycles - pacing.start_cycles) * 1000000000 / CLOCK_RATE);
+	auto now = std::chrono::steady_clock::now();
+	if (due > now)
+		std::this_thread::sleep_until(due);
+	else if (now - due > std::chrono::milliseconds(100))
+	{
+		// After a stall, carry on from now rather than catching up
+		pacing.start = now;
+		pacing.start_cycles = m.cycles;
+	}
+	if (movie.mode == MOVIE_OFF)
+		ApplyInputs(input, m);
 }
 
-int ExecuteInstruction()
+// Scheduled right after each vblank interrupt while a movie runs. Input
+// held live changes the ports only here then, so each frame records what
+// the machine saw.
+void StartMovieFrame(Machine &m, void *context)
 {
-	u8 opcode = mem::Read(GetPC());
+	if (movie.mode == MOVIE_RECORDING)
+		ApplyInputs(input, m);
+	StepMovie(m);
+}
 
-	switch (opcode)
+// The machine runs on its own thread, from one scheduled event to the
+// next; it keeps to real time but never waits for the display
+void RunMachine()
+{
+	Pacing pacing = { std::chrono::steady_clock::now(), machine.cycles };
+	Scheduler scheduler;
+	InitializeScheduler(scheduler);
+	ScheduleInterrupts(scheduler, machine);
+	ScheduleEvent(scheduler, NextDeadline(machine, HALF_FRAME_CYCLES, 0), HALF_FRAME_CYCLES, HandOffFrame, &exchange);
+	ScheduleEvent(scheduler, NextDeadline(machine, INPUT_POLL_CYCLES, 0), INPUT_POLL_CYCLES, PollInput, &pacing);
+	if (movie.mode != MOVIE_OFF)
+		ScheduleEvent(scheduler, NextDeadline(machine, FRAME_CYCLES, 0), FRAME_CYCLES, StartMovieFrame, NULL);
+
+	while (machine.running && !quit.load(std::memory_order_relaxed))
+		RunToNextEvent(scheduler, machine);
+	quit = true;
+}
+
+// SDL wants events and video on the main thread, so that is where frames
+// are presented, REFRESH_RATE times a second. Between refreshes the thread
+// sleeps on the event queue, so input is handed on as soon as it arrives.
+// A refresh with no new frame shows the previous one again. Returns the
+// number of those.
+long long RunDisplay()
+{
+	const auto refresh = std::chrono::nanoseconds(1000000000 / REFRESH_RATE);
+	long long duplicated = 0;
+
+	auto next = std::chrono::steady_clock::now();
+	while (!quit.load(std::memory_order_relaxed))
 	{
-		/* 00000000 */
-	case 0x00: return NOP();
-		/* 00xxxxxx */
-	case 0x07: return RLC();
-	case 0x0F: return RRC();
-	case 0x17: return RAL();
-	case 0x1F: return RAR();
-	case 0x22: return SHLD();
-	case 0x27: return DAA();
-	case 0x2A: return LHLD();
-	case 0x2F: return CMA();
-	case 0x32: return STA();
-	case 0x37: return STC();
-	case 0x3A: return LDA();
-	case 0x3F: return CMC();
-		/* 01110110 */
-	case 0x76: return HLT();
-		/* 11xxxxxx */
-	case 0xC0: return RNZ();
-	case 0xC2: return JNZ();
-	case 0xC3: return JMP();
-	case 0xC4: return CNZ();
-	case 0xC6: return ADI();
-	case 0xC8: return RZ();
-	case 0xC9: return RET();
-	case 0xCA: return JZ();
-	case 0xCC: return CZ();
-	case 0xCE: return ACI();
-	case 0xCD: return CALL();
-	case 0xD0: return RNC();
-	case 0xD2: return JNC();
-	case 0xD3: return OUT();
-	case 0xD4: return CNC();
-	case 0xD6: return SUI();
-	case 0xD8: return RC();
-	case 0xDA: return JC();
-	case 0xDB: return IN();
-	case 0xDC: return CC();
-	case 0xDE: return SBI();
-	case 0xE0: return RPO();
-	case 0xE2: return JPO();
-	case 0xE3: return XTHL();
-	case 0xE4: return CPO();
-	case 0xE6: return ANI();
-	case 0xE8: return RPE();
-	case 0xE9: return PCHL();
-	case 0xEA: return JPE();
-	case 0xEB: return XCHG();
-	case 0xEC: return CPE();
-	case 0xEE: return XRI();
-	case 0xF0: return RP();
-	case 0xF2: return JP();
-	case 0xF3: return DI();
-	case 0xF4: return CP();
-	case 0xF6: return ORI();
-	case 0xF8: return RM();
-	case 0xF9: return SPHL();
-	case 0xFC: return CM();
-	case 0xFA: return JM();
-	case 0xFB: return EI();
-	case 0xFE: return CPI();
-		/* Other */
-	default:
-		switch ((opcode & 0xC0) >> 6) // Get two leftmost bits
+		SDL_Event e;
+		for (auto now = std::chrono::steady_clock::now(); now < next; now = std::chrono::steady_clock::now())
 		{
-			/* 00xxxxxx */
-		case 0:
-			if ((opcode & 0x07) < 4) // Get three rightmost bits
-			{
-				switch (opcode & 0x0F)
-				{
-				case 1:		return LXI(REG_PAIR);	// 00xx0001
-				case 2:		return STAX(REG_PAIR);	// 00xx0010
-				case 3:		return INX(REG_PAIR);	// 00xx0011
-				case 9:		return DAD(REG_PAIR);	// 00xx1001
-				case 10:	return LDAX(REG_PAIR);	// 00xx1010
-				case 11:	return DCX(REG_PAIR);	// 00xx1011
-				}
-			}
-			else
-			{
-				switch (opcode & 0x07)
-				{
-				case 4:		return INR(DDD);	// 00xxx100
-				case 5:		return DCR(DDD);	// 00xxx101
-				case 6:		return MVI(DDD);	// 00xxx110
-				}
-			}
-			break;
+			// Rounded up, as a wait of 0 would only poll
+			int wait = (int)std::chrono::duration_cast<std::chrono::milliseconds>(next - now + std::chrono::nanoseconds(999999)).count();
+			if (SDL_WaitEventTimeout(&e, wait) != 0)
+				HandleEvent(e);
+		}
+		while (SDL_PollEvent(&e) != 0)
+			HandleEvent(e);
 
-			/* 01xxxxxx */
-		case 1: return MOV(SSS, DDD);
-
-			/* 10xxxxxx */
-		case 2:
-			switch ((opcode & 0x38) >> 3)
-			{
-			case 0: return ADD(SSS);	// 10000xxx
-			case 1: return ADC(SSS);	// 10001xxx
-			case 2: return SUB(SSS);	// 10010xxx
-			case 3: return SBB(SSS);	// 10011xxx
-			case 4: return ANA(SSS);	// 10100xxx
-			case 5: return XRA(SSS);	// 10101xxx
-			case 6: return ORA(SSS);	// 10110xxx
-			case 7: return CMP(SSS);	// 10111xxx
-			}
-			break;
+		const u8 *vram = TakeFrame(exchange);
+		if (vram != NULL)
+		{
+			Draw(vram);
+			InputsPresented(input, (u16)FrameTag(exchange), Now(), latency);
+		}
+		else
+			duplicated++;
 
-			/* 11xxxxxx */
-		case 3:
-			switch (opcode & 0x07)
-			{
-			case 1: return POP(REG_PAIR);	// 11xxx001
-			case 5: return PUSH(REG_PAIR);	// 11xxx101
-			case 7: return RST(EXP);		// 11xxx111
-			}
+		// After a stall, carry on from now rather than catching up
+		next = std::max(next + refresh, std::chrono::steady_clock::now());
+	}
+	return duplicated;
+}
+
+// Summarizes the input latency histogram and writes it out in full
+void ReportLatency()
+{
+	if (latency.samples == 0)
+		return;
+	std::cout << latency.samples << " input changes presented after " << (latency.total_ms / latency.samples) << " ms on average, ";
+	std::cout << "50% within " << LatencyPercentile(latency, 0.5) << " ms, 99% within " << LatencyPercentile(latency, 0.99) << " ms, ";
+	std::cout << "at most " << latency.max_ms << " ms\n";
+
+	FILE *f = fopen("input_latency.txt", "w");
+	if (f == NULL)
+		return;
+	fprintf(f, "ms,changes\n");
+	for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+		fprintf(f, "%d,%lld\n", bucket, latency.counts[bucket]);
+	fclose(f);
+}
+
+#endif
+
+// Runs frames as fast as possible without video and reports throughput.
+// Movie playback stops the run where the movie ends.
+void RunHeadless(int frames)
+{
+	long long instructions = 0;
+	int frame = 0;
+	bool playing = (movie.mode == MOVIE_PLAYING);
+
+	// Movie frames start right after a vblank interrupt
+	if (movie.mode != MOVIE_OFF)
+	{
+		do
+			EmulateHalfFrame(machine);
+		while ((machine.cycles / HALF_FRAME_CYCLES) & 1);
+	}
+	long long start_cycles = machine.cycles;
+	long long start_skipped = machine.skipped_cycles;
+
+	auto start = std::chrono::steady_clock::now();
+	for (; frame < frames && machine.running; frame++)
+	{
+		StepMovie(machine);
+		if (playing && movie.mode == MOVIE_OFF)
 			break;
-		}
+		instructions += EmulateHalfFrame(machine);
+		instructions += EmulateHalfFrame(machine);
 	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	double seconds = elapsed.count();
+	std::cout << frame << " frames, " << instructions << " instructions in " << seconds << " s\n";
+	std::cout << (frame / seconds) << " frames/s, " << (instructions / seconds) << " instructions/s\n";
+	if (machine.cycles > start_cycles)
+		std::cout << (100.0 * (machine.skipped_cycles - start_skipped) / (machine.cycles - start_cycles)) << "% of cycles idle and skipped\n";
+	if (machine.dropped_writes > 0)
+		std::cout << machine.dropped_writes << " writes to ROM or unmapped memory dropped\n";
+}
 
-	running = false; // TODO: handle invalid opcodes
-	return 4;
+// Scripted port 1 input: a coin, 1P start, then left, right and fire held
+// in random combinations for 16 frames at a time
+std::vector<u8> MakeInputs(u32 seed, int frames)
+{
+	std::vector<u8> inputs(frames, 0);
+	u32 x = seed * 2654435761u + 1;
+	u8 held = 0;
+	for (int frame = 0; frame < frames; frame++)
+	{
+		if (frame % 16 == 0)
+		{
+			x ^= x << 13; x ^= x >> 17; x ^= x << 5;	// xorshift32
+			held = x & 0x70;
+		}
+		if (frame >= 60 && frame < 64)
+			inputs[frame] = 0x01;	// coin
+		else if (frame >= 120 && frame < 124)
+			inputs[frame] = 0x04;	// 1P start
+		else if (frame >= 180)
+			inputs[frame] = held;
+	}
+	return inputs;
 }
 
-void Emulate8080(int cycles)
+// Runs instances machines for frames frames each on threads threads (0 for
+// every core), writes their results to batch_output.txt and reports throughput
+bool RunBatchFromBoot(int instances, int frames, int threads)
 {
-	int elapsed_cycles = 0;
+	std::vector<BatchInstance> batch(instances);
+	for (int i = 0; i < instances; i++)
+	{
+		batch[i].frames = frames;
+		batch[i].inputs = MakeInputs(i, frames);
+	}
+
+	BatchReport report = RunBatch(machine, batch, threads);
+
+	FILE *f = fopen("batch_output.txt", "w");
+	if (f == NULL)
+		return false;
+	fprintf(f, "instance,frames,instructions,hash\n");
+	for (int i = 0; i < instances; i++)
+		fprintf(f, "%d,%d,%lld,%016llx\n", i, report.results[i].frames, report.results[i].instructions,
+			(unsigned long long)report.results[i].hash);
+	fclose(f);
+
+	double frames_per_second = report.frames / report.seconds;
+	std::cout << instances << " instances, " << report.frames << " frames, " << report.instructions << " instructions in " << report.seconds << " s on " << report.threads << " threads\n";
+	std::cout << frames_per_second << " frames/s, " << (frames_per_second / report.threads) << " frames/s per core\n";
+	return true;
+}
 
-	while (elapsed_cycles < cycles)
+// Opens the ROM set and attaches it to the machine; batch instances copied
+// from it share the one image. A set that is not the known dump is
+// reported but runs.
+bool LoadRomSet(const char *path)
+{
+	if (!OpenRomImage(rom, path))
 	{
-		elapsed_cycles += ExecuteInstruction();
+		std::cout << "Cannot load the ROM set from " << path << "\n";
+		return false;
 	}
+
+	int bad_banks = CheckRom(rom.data);
+	for (int bank = 0; bank < ROM_BANKS; bank++)
+		if (bad_banks & (1 << bank))
+			printf("%s: CRC32 %08x, not the known dump\n", rom_banks[bank].name, Crc32(rom.data + bank * ROM_BANK_SIZE, ROM_BANK_SIZE));
+
+	AttachRom(machine, rom);
+	return true;
 }
 
-void GenerateInterrupt(int addr)
+// Replaces the booted machine with a saved one
+bool LoadStateFile(const char *path)
 {
-	StackPush(i8080.pc);
-	i8080.pc = addr;
+	static SaveState snapshot;
+	if (!ReadSaveState(snapshot, path))
+		return false;
+	RestoreMachine(machine, snapshot);
+	return true;
 }
 
-void Draw()
+bool SaveStateFile(const char *path)
 {
-	int display[224 * 256];
-	int c = 0;
-	for (int i = 0x2400; i < 0x4000; i++)
-		for (int j = 0; j < 8; j++)
-		{
-			display[c] = (mem::Read(i) & (1 << j));
-			c++;
-		}
+	static SaveState snapshot;
+	SaveMachine(machine, snapshot);
+	return WriteSaveState(snapshot, path);
+}
 
-	c = 0;
-	u32 *pixels = (u32*)surface_native->pixels;
-	for (int i = 0; i < WIDTH; i++)
+// Starts recording or playing a movie from the machine as it is now
+bool StartMovieFile(const char *record, const char *play)
+{
+	if (record != NULL && !StartRecording(movie, record, machine))
 	{
-		pixels += (i) ? 1 : 0;
-		c++;
-		for (int j = HEIGHT - 1; j > 0; j--)
-			pixels[WIDTH * j] = (display[c++]) ? 0x00ffffff : 0;
+		std::cout << "Cannot write " << record << "\n";
+		return false;
 	}
+	if (play != NULL && !StartPlayback(movie, play, machine))
+	{
+		std::cout << "Cannot play " << play << ": unreadable, or recorded from another machine state\n";
+		return false;
+	}
+	return true;
+}
 
-	SDL_BlitScaled(surface_native, NULL, surface, NULL);
-	SDL_UpdateWindowSurface(window);
+void StopMovieFile()
+{
+	if (movie.file == NULL)
+		return;
+	bool recording = (movie.mode == MOVIE_RECORDING);
+	std::cout << movie.frames << " movie frames " << (recording ? "recorded" : "played") << "\n";
+	if (!StopMovie(movie))
+		std::cout << "Cannot write the movie\n";
+}
+
+// Profiling builds leave their report in profile.txt on exit
+void WriteProfile()
+{
+#ifdef PROFILE
+	if (!profiler::WriteReport(machine, "profile.txt"))
+		std::cout << "Cannot write profile.txt\n";
+#endif
+}
+
+// Translated blocks are only valid for the ROM they were built from, so
+// this runs after LoadRomSet()
+void StartJit(bool use_jit)
+{
+	if (use_jit && !InitializeJit())
+		std::cout << "JIT not available, using the interpreter.\n";
 }
 
 int main(int argc, char *argv[])
 {
-	if (Initialize() & LoadRom())
+	int headless_frames = 0;
+	int batch_instances = 0, batch_frames = 0, batch_threads = 0;
+	bool use_jit = false;
+	const char *load_state = NULL, *save_state = NULL;
+	const char *record_movie = NULL, *play_movie = NULL;
+	const char *rom_path = ".";
+#ifndef NO_SDL
+	const char *bindings_file = NULL;
+#endif
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--headless") && i + 1 < argc)
+			headless_frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--batch") && i + 2 < argc)
+		{
+			batch_instances = atoi(argv[++i]);
+			batch_frames = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			batch_threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--jit"))
+			use_jit = true;
+		else if (!strcmp(argv[i], "--rom") && i + 1 < argc)
+			rom_path = argv[++i];
+		else if (!strcmp(argv[i], "--load-state") && i + 1 < argc)
+			load_state = argv[++i];
+		else if (!strcmp(argv[i], "--save-state") && i + 1 < argc)
+			save_state = argv[++i];
+		else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+			record_movie = argv[++i];
+		else if (!strcmp(argv[i], "--play") && i + 1 < argc)
+			play_movie = argv[++i];
+#ifndef NO_SDL
+		else if (!strcmp(argv[i], "--bindings") && i + 1 < argc)
+			bindings_file = argv[++i];
+#endif
+	}
+
+	// Cleared before the ROM is attached
+	InitializeMachine(machine);
+
+	if (batch_instances > 0)
+	{
+		if (!LoadRomSet(rom_path))
+			return 1;
+
+		if (use_jit)
+			std::cout << "The JIT is single-threaded, batches use the interpreter.\n";
+		if (!RunBatchFromBoot(batch_instances, batch_frames, batch_threads))
+			std::cout << "Cannot write batch_output.txt\n";
+		return 0;
+	}
+
+	if (headless_frames > 0)
+	{
+		if (!LoadRomSet(rom_path))
+			return 1;
+
+		if (load_state != NULL && !LoadStateFile(load_state))
+		{
+			std::cout << "Cannot load " << load_state << "\n";
+			return 1;
+		}
+
+		if (!StartMovieFile(record_movie, play_movie))
+			return 1;
+
+		StartJit(use_jit);
+		RunHeadless(headless_frames);
+		StopMovieFile();
+		WriteProfile();
+		if (save_state != NULL && !SaveStateFile(save_state))
+			std::cout << "Cannot write " << save_state << "\n";
+		return 0;
+	}
+
+#ifndef NO_SDL
+	if (bindings_file != NULL && !LoadBindings(bindings_file))
+	{
+		std::cout << "Cannot read key bindings from " << bindings_file << "\n";
+		return 1;
+	}
+
+	if (Initialize() & LoadRomSet(rom_path))
 	{
-		int interrupt_switch = 0;
-		while (running)
+		if (load_state != NULL && !LoadStateFile(load_state))
 		{
-			Emulate8080((2000000 / 60) / 2);
-			if (i8080.INTE)
-			{
-				GenerateInterrupt((interrupt_switch) ? 0x10 : 0x08);
-				interrupt_switch = ~interrupt_switch;
-				i8080.INTE = 0;
-			}
-			Draw();
+			std::cout << "Cannot load " << load_state << "\n";
+			return 1;
 		}
+		if (!StartMovieFile(record_movie, play_movie))
+			return 1;
+
+		StartJit(use_jit);
+		std::thread cpu(RunMachine);
+		long long duplicated = RunDisplay();
+		cpu.join();
+		StopMovieFile();
+		WriteProfile();
+		std::cout << exchange.published << " frames published, " << exchange.dropped << " dropped, " << duplicated << " refreshes duplicated\n";
+		ReportLatency();
 	}
 	else
 		std::cout << "Error.\n";
+#else
+	std::cout << "Usage: " << argv[0] << " [--rom <dir or image>] [--jit] [--load-state <file>] [--save-state <file>] [--record <file> | --play <file>] --headless <frames>\n";
+	std::cout << "       " << argv[0] << " [--rom <dir or image>] --batch <instances> <frames> [--threads <n>]\n";
+#endif
 
 	return 0;
 }
@@ -1,6 +0,0 @@
-#include "memory.h"
-
-namespace mem
-{
-	u8 memory[0xFFFF];
-}
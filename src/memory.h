@@ -2,43 +2,62 @@
 #define MEMORY_H
 
 #include "common.h"
+#include "machine.h"
 
-#include <iostream>
+#include <cstddef>
 
-namespace mem
+#ifdef DECODE_CACHE
+
+// Drops the decoded entries whose bytes include address
+inline void InvalidateDecoded(Machine &m, u16 address)
 {
-	extern u8 memory[0xFFFF];
+	if (!m.decoded_pages[address >> 8])
+		return;
+
+	m.decode_cache[address].valid = false;
+	m.decode_cache[(u16)(address - 1)].valid = false;
+	m.decode_cache[(u16)(address - 2)].valid = false;
+}
+
+#endif
 
-	inline u8 Read(u16 address)
+namespace mem
+{
+	inline u8 Read(const Machine &m, u16 address)
 	{
-		return memory[address];
+		return m.read_pages[address >> 8][address & 0xFF];
 	}
 
-	inline void LoadROM(u16 addr, u8 data)
+	// Stores straight into ROM; addr must lie in 0x0000-0x1FFF. A shared
+	// image is copied into the machine's own memory first.
+	inline void LoadROM(Machine &m, u16 addr, u8 data)
 	{
-		memory[addr] = data;
+		if (m.rom != m.memory)
+			UnshareRom(m);
+		m.memory[addr] = data;
+#ifdef DECODE_CACHE
+		InvalidateDecoded(m, addr);
+#endif
 	}
 
-	inline void Write(u16 address, u8 data)
+	inline void Write(Machine &m, u16 address, u8 data)
 	{
-		if (address < 0x2000)
+		u8 *page = m.write_pages[address >> 8];
+		if (page == NULL)
 		{
-			std::cout << "ERROR: Cannot overwrite ROM.\n";
+			m.dropped_writes++;
+			return;
 		}
-		else if (address > 0x4000)
-			memory[address - 0x2000] = data;
-		else
-			memory[address] = data;
-	}
 
-	inline void Increment(u16 address)
-	{
-		memory[address]++; // TODO: overflow? status?
-	}
+		page[address & 0xFF] = data;
+		m.writes++;
 
-	inline void Decrement(u16 address)
-	{
-		memory[address]--; // TODO: overflow? status?
+		// Where the byte is stored, which differs from address in the mirror
+		u16 stored = (u16)(page - m.memory) | (address & 0xFF);
+		m.dirty_pages[stored >> 8] = 0xFF;
+#ifdef DECODE_CACHE
+		InvalidateDecoded(m, stored);
+#endif
 	}
 }
 
@@ -0,0 +1,114 @@
+#include "movie.h"
+#include "batch.h"
+
+#include <cstring>
+
+const char movie_magic[6] = { 'I', '8', '0', '8', '0', 'M' };
+
+inline void PutBytes(u8 *p, u64 value, int count)
+{
+	for (int i = 0; i < count; i++)
+		p[i] = (u8)(value >> (8 * i));
+}
+
+inline u64 GetBytes(const u8 *p, int count)
+{
+	u64 value = 0;
+	for (int i = 0; i < count; i++)
+		value |= (u64)p[i] << (8 * i);
+	return value;
+}
+
+void StartMovie(Movie &movie, FILE *file, MovieMode mode)
+{
+	movie.file = file;
+	movie.mode = mode;
+	movie.frames = 0;
+	movie.desync_frame = -1;
+	movie.write_failed = false;
+}
+
+bool StartRecording(Movie &movie, const char *path, Machine &m)
+{
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return false;
+
+	u8 header[MOVIE_HEADER_SIZE];
+	memcpy(header, movie_magic, sizeof(movie_magic));
+	PutBytes(header + 6, MOVIE_VERSION, 2);
+	PutBytes(header + 8, (u64)m.cycles, 8);
+	PutBytes(header + 16, HashMachine(m), 8);
+
+	StartMovie(movie, f, MOVIE_RECORDING);
+	movie.write_failed = fwrite(header, 1, sizeof(header), f) != sizeof(header);
+	return !movie.write_failed;
+}
+
+bool StartPlayback(Movie &movie, const char *path, Machine &m)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return false;
+
+	u8 header[MOVIE_HEADER_SIZE];
+	if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+		memcmp(header, movie_magic, sizeof(movie_magic)) ||
+		GetBytes(header + 6, 2) != MOVIE_VERSION ||
+		(long long)GetBytes(header + 8, 8) != m.cycles ||
+		GetBytes(header + 16, 8) != HashMachine(m))
+	{
+		fclose(f);
+		return false;
+	}
+
+	StartMovie(movie, f, MOVIE_PLAYING);
+	return true;
+}
+
+bool MovieFrame(Movie &movie, Machine &m)
+{
+	u8 record[MOVIE_FRAME_SIZE];
+	u32 hash = (u32)HashMachine(m);
+
+	if (movie.mode == MOVIE_RECORDING)
+	{
+		record[0] = m.dipswitch_1;
+		record[1] = m.dipswitch_2;
+		PutBytes(record + 2, hash, 4);
+		if (fwrite(record, 1, sizeof(record), movie.file) != sizeof(record))
+			movie.write_failed = true;
+		movie.frames++;
+		return true;
+	}
+
+	if (movie.mode != MOVIE_PLAYING)
+		return false;
+
+	if (fread(record, 1, sizeof(record), movie.file) != sizeof(record))
+	{
+		movie.mode = MOVIE_OFF;
+		return false;
+	}
+	if ((u32)GetBytes(record + 2, 4) != hash)
+	{
+		movie.desync_frame = movie.frames;
+		movie.mode = MOVIE_OFF;
+		return false;
+	}
+
+	m.dipswitch_1 = record[0];
+	m.dipswitch_2 = record[1];
+	movie.frames++;
+	return true;
+}
+
+bool StopMovie(Movie &movie)
+{
+	bool written = !movie.write_failed;
+	if (movie.file != NULL && fclose(movie.file) != 0 && movie.mode == MOVIE_RECORDING)
+		written = false;
+	movie.file = NULL;
+	movie.mode = MOVIE_OFF;
+	return written;
+}
@@ -0,0 +1,56 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include "common.h"
+#include "machine.h"
+
+#include <cstdio>
+
+// Input movies: the port 1 and 2 bytes (dipswitch_1 and dipswitch_2) of
+// every frame, so a session can be replayed exactly, headless or not. A
+// frame starts right after a vblank interrupt, the first one after the
+// movie starts, and its inputs hold for the whole frame. Each frame also
+// stores a hash of the CPU and RAM as the frame starts, which playback
+// checks before applying the frame's inputs, so a desync is caught on the
+// frame where it happens. The file is written and read a frame at a time:
+//
+//   header  "I8080M", u16 version, u64 cycle count and u64 HashMachine()
+//           of the machine the movie starts from
+//   frames  u8 port 1, u8 port 2, u32 low half of HashMachine()
+//
+// all little-endian.
+
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE (8 + 8 + 8)
+#define MOVIE_FRAME_SIZE (2 + 4)
+
+enum MovieMode
+{
+	MOVIE_OFF,
+	MOVIE_RECORDING,
+	MOVIE_PLAYING,
+};
+
+struct Movie
+{
+	FILE *file;
+	MovieMode mode;
+	long long frames;			// recorded or played so far
+	long long desync_frame;		// first frame whose hash did not match, or -1
+	bool write_failed;
+};
+
+// Start a movie from the machine as it is now. Playback fails if the
+// machine is not the one the movie was recorded from.
+bool StartRecording(Movie &movie, const char *path, Machine &m);
+bool StartPlayback(Movie &movie, const char *path, Machine &m);
+
+// Called as each frame starts: records the ports and the hash, or checks
+// the hash and sets the ports. Returns false, and turns the movie off, when
+// playback runs out of frames or desyncs.
+bool MovieFrame(Movie &movie, Machine &m);
+
+// Closes the file; returns false if anything recorded was not written
+bool StopMovie(Movie &movie);
+
+#endif /*MOVIE_H*/
@@ -6,16 +6,16 @@
 
 /********** Carry Bit Instructions **********/
 // Compliment Carry
-inline int CMC()
+inline int CMC(Machine &m)
 {
-	CARRY = ~CARRY;
+	m.cpu.flags ^= FLAG_C;
 	PC++;
 	return 4;
 }
 // Set Carry
-inline int STC()
+inline int STC(Machine &m)
 {
-	CARRY = 1;
+	SetCarry(m, 1);
 	PC++;
 	return 4;
 }
@@ -24,72 +24,35 @@ inline int STC()
 
 /********** Single Register Instructions **********/
 // Increment Register or Memory
-inline int INR(int DDD)
+template <int DDD>
+inline int INR(Machine &m)
 {
-	if (DDD == 6)
-	{
-		// Increment memory
-		u8 num = mem::Read(H_L);
-		mem::Increment(H_L);
-		PC++;
-
-		// Status bits
-		SetZero(mem::Read(H_L));
-		SetSign(mem::Read(H_L));
-		SetParity(mem::Read(H_L));
-		SetAuxCarry(num, (u8)1);
-	}
-	else
-	{
-		// Increment register
-		u8 num = i8080.registers[DDD];
-		i8080.registers[DDD]++;
-		PC++;
+	u8 num = GetOperand<DDD>(m);
+	u8 result = num + 1;
+	SetOperand<DDD>(m, result);
 
-		// Status bits
-		SetZero(i8080.registers[DDD]);
-		SetSign(i8080.registers[DDD]);
-		SetParity(i8080.registers[DDD]);
-		SetAuxCarry(num, (u8)1);
-	}
+	// Status bits
+	FlagsAdd(m, num, 1, result);
 
 	PC++;
-	return (DDD == 6) ? 10 : 5;
+	return (DDD == M) ? 10 : 5;
 }
 // Decrement Register or Memory
-inline int DCR(int DDD)
+template <int DDD>
+inline int DCR(Machine &m)
 {
-	u8 num;
-	if (DDD == 6)
-	{
-		// Decrement memory
-		num = mem::Read(H_L);
-		mem::Decrement(H_L);
-
-		// Status bits
-		SetZero(mem::Read(H_L));
-		SetSign(mem::Read(H_L));
-		SetParity(mem::Read(H_L));
-		SetAuxBorrow(num, (u8)1);
-	}
-	else
-	{
-		// Decrement register
-		num = i8080.registers[DDD];
-		i8080.registers[DDD]--;
-
-		// Status bits
-		SetZero(i8080.registers[DDD]);
-		SetSign(i8080.registers[DDD]);
-		SetParity(i8080.registers[DDD]);
-		SetAuxBorrow(num, (u8)1);
-	}
+	u8 num = GetOperand<DDD>(m);
+	u8 result = num - 1;
+	SetOperand<DDD>(m, result);
+
+	// Status bits
+	FlagsSub(m, num, 1, result);
 
 	PC++;
-	return (DDD == 6) ? 10 : 5;
+	return (DDD == M) ? 10 : 5;
 }
 // Complement Accumulator
-inline int CMA()
+inline int CMA(Machine &m)
 {
 	ACC = ~ACC;
 	PC++;
@@ -97,28 +60,26 @@ inline int CMA()
 	return 4;
 }
 // Decimal Adjust Accumulator
-inline int DAA()
+inline int DAA(Machine &m)
 {
-	if ((ACC & 0x0F) > 0x9 || AUX_CARRY == 1)	// step 1
-	{
-		ACC += 0x6;
-		AUX_CARRY = 1;
-	}
-	else
-		AUX_CARRY = 0;
+	u8 a = ACC;
+	u8 correction = 0;
+	int carry = GetCarry(m);
+
+	if ((a & 0x0F) > 0x9 || GetAuxCarry(m))	// step 1
+		correction |= 0x06;
 
-	if ((ACC & 0xF0) > 0x9 || CARRY == 1)		// step 2
+	if (a > 0x99 || carry)					// step 2
 	{
-		ACC = ((((ACC & 0xF0) >> 2) + 0x6) << 4) | (ACC & 0x0F);
-		CARRY = 1;
+		correction |= 0x60;
+		carry = 1;
 	}
-	else
-		CARRY = 0;
+
+	ACC = a + correction;
 
 	// Status bits
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
+	SetCarry(m, carry);
+	FlagsAdd(m, a, correction, ACC);
 
 	PC++;
 
@@ -129,7 +90,7 @@ inline int DAA()
 
 /********** NOP Instruction **********/
 // No Operation
-inline int NOP()
+inline int NOP(Machine &m)
 {
 	PC++;
 	// No status.
@@ -140,39 +101,29 @@ inline int NOP()
 
 /********** Data Transfer Instructions **********/
 // Move Byte from Src to Dst
-inline int MOV(int SSS, int DDD)
+template <int SSS, int DDD>
+inline int MOV(Machine &m)
 {
-	// Get src
-	int src;
-	if (SSS == 6)
-		src = mem::Read(H_L);
-	else
-		src = i8080.registers[SSS];
-
-	// Get dst
-	if (DDD == 6)
-		mem::Write(H_L, src);
-	else
-		i8080.registers[DDD] = src;
+	SetOperand<DDD>(m, GetOperand<SSS>(m));
 
 	PC++;
 	// No status.
-	return (SSS == 6 || DDD == 6) ? 7 : 5;
+	return (SSS == M || DDD == M) ? 7 : 5;
 }
 // Store Accumulator
-inline int STAX(int X)
+template <int RP>
+inline int STAX(Machine &m)
 {
-	int upper_index = (X) ? 2 : 0;
-	mem::Write((i8080.registers[upper_index] << 8) | i8080.registers[upper_index + 1], ACC);
+	mem::Write(m, GetPair<RP>(m), ACC);
 	PC++;
 	// No status.
 	return 7;
 }
 // Load Accumulator
-inline int LDAX(int X)
+template <int RP>
+inline int LDAX(Machine &m)
 {
-	int upper_index = (X) ? 2 : 0;
-	ACC = mem::Read((i8080.registers[upper_index] << 8) | i8080.registers[upper_index + 1]);
+	ACC = mem::Read(m, GetPair<RP>(m));
 	PC++;
 	// No status.
 	return 7;
@@ -182,167 +133,159 @@ inline int LDAX(int X)
 
 /*********** Register or Memory to Accumulator Instructions **********/
 // Add Register or Memory to Accumulator
-inline int ADD(int RP)
+template <int RP>
+inline int ADD(Machine &m)
 {
 	u8 a = ACC;
-	u8 b = (RP == 6) ? mem::Read(H_L) : i8080.registers[RP];
-	ACC += b;
+	u8 b = GetOperand<RP>(m);
+	u16 sum = a + b;
+	ACC = sum;
 
 	// Status bits
-	SetZero(ACC);
-	SetSign(ACC);
-	SetCarry(a, b);
-	SetAuxCarry(a, b);
+	SetCarry(m, sum >> 8);
+	FlagsAdd(m, a, b, ACC);
 
 	PC++;
-	return (RP == 6) ? 7 : 4;
+	return (RP == M) ? 7 : 4;
 }
 // Add Register or Memory to Accumulator with Carry
-inline int ADC(int RP)
+template <int RP>
+inline int ADC(Machine &m)
 {
 	u8 a = ACC;
-	u8 b = (RP == 6) ?
-		mem::Read(H_L) + CARRY : i8080.registers[RP] + CARRY;
-	ACC += b;
+	u8 b = GetOperand<RP>(m);
+	u16 sum = a + b + CARRY;
+	ACC = sum;
 
 	// Status bits
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
-	SetCarry(a, b);
-	SetAuxCarry(a, b);
+	SetCarry(m, sum >> 8);
+	FlagsAdd(m, a, b, ACC);
 
 	PC++;
-	return (RP == 6) ? 7 : 4;
+	return (RP == M) ? 7 : 4;
 }
 // Subtract Register or Memoryfrom Accumulator
-inline int SUB(int RP)
+template <int RP>
+inline int SUB(Machine &m)
 {
 	u8 a = ACC;
-	u8 b = (RP == 6) ? -mem::Read(H_L) : -i8080.registers[RP];
-	ACC += b;
+	u8 b = GetOperand<RP>(m);
+	u16 difference = a - b;
+	ACC = difference;
 
 	// Status bits
-	SetZero(ACC);
-	SetSign(ACC);
-	SetBorrow(a, b);
-	SetAuxBorrow(a, b);
+	SetCarry(m, (difference >> 8) & 1);
+	FlagsSub(m, a, b, ACC);
 
 	PC++;
-	return (RP == 6) ? 7 : 4;
+	return (RP == M) ? 7 : 4;
 }
 // Subtract Register or Memory from Accumulator with Carry
-inline int SBB(int RP)
+template <int RP>
+inline int SBB(Machine &m)
 {
 	u8 a = ACC;
-	u8 b = (RP == 6) ?
-		-mem::Read(H_L) + CARRY : -i8080.registers[RP] + CARRY;
-	ACC += b;
+	u8 b = GetOperand<RP>(m);
+	u16 difference = a - b - CARRY;
+	ACC = difference;
 
 	// Status bits
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
-	SetBorrow(a, b);
-	SetAuxBorrow(a, b);
+	SetCarry(m, (difference >> 8) & 1);
+	FlagsSub(m, a, b, ACC);
 
 	PC++;
-	return (RP == 6) ? 7 : 4;
+	return (RP == M) ? 7 : 4;
 }
 // Logical AND Register or Memory with Accumulator
-inline int ANA(int RP)
+template <int RP>
+inline int ANA(Machine &m)
 {
-	ACC &= (RP == 6) ? mem::Read(H_L) : i8080.registers[RP];
+	u8 a = ACC;
+	u8 b = GetOperand<RP>(m);
+	ACC = a & b;
 
 	// Status bits
-	CARRY = 0;
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
+	SetCarry(m, 0);
+	FlagsAnd(m, a, b, ACC);
 
 	PC++;
-	return (RP == 6) ? 7 : 4;
+	return (RP == M) ? 7 : 4;
 }
 // Logical XOR Register or Memory with Accumulator
-inline int XRA(int RP)
+template <int RP>
+inline int XRA(Machine &m)
 {
-	ACC ^= (RP == 6) ? mem::Read(H_L) : i8080.registers[RP];
+	ACC ^= GetOperand<RP>(m);
 
 	// Status bits
-	CARRY = 0;
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
-	// TODO: aux carry?
+	SetCarry(m, 0);
+	FlagsLogic(m, ACC);
 
 	PC++;
-	return (RP == 6) ? 7 : 4;
+	return (RP == M) ? 7 : 4;
 }
 // Logical OR Register with Accumulator
-inline int ORA(int RP)
+template <int RP>
+inline int ORA(Machine &m)
 {
-	ACC |= (RP == 6) ? mem::Read(H_L) : i8080.registers[RP];
+	ACC |= GetOperand<RP>(m);
 
 	// Status bits
-	CARRY = 0;
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
+	SetCarry(m, 0);
+	FlagsLogic(m, ACC);
 
 	PC++;
-	return (RP == 6) ? 7 : 4;
+	return (RP == M) ? 7 : 4;
 }
 // Compare Register or Memory with Accumulator
-inline int CMP(int RP)
+template <int RP>
+inline int CMP(Machine &m)
 {
-	u8 num = (RP == 6) ? mem::Read(H_L) : i8080.registers[RP];
-	u8 result = ACC - num;
+	u8 num = GetOperand<RP>(m);
+	u16 difference = ACC - num;
 
 	// Status bits
-	SetZero(result);
-	SetSign(result);
-	SetParity(result);
-	SetBorrow(ACC, num);
-	SetAuxBorrow(ACC, num);
+	SetCarry(m, (difference >> 8) & 1);
+	FlagsSub(m, ACC, num, difference);
 
 	PC++;
-	return (RP == 6) ? 7 : 4;
+	return (RP == M) ? 7 : 4;
 }
 
 
 	
 /********** Rotate Accumulator Instructions **********/
 // Rotate Accumulator Left
-inline int RLC()
+inline int RLC(Machine &m)
 {
-	CARRY = ((ACC & 0x80) >> 7);
+	SetCarry(m, (ACC & 0x80) >> 7);
 	ACC = ((ACC << 1) | CARRY);
 	PC++;
 	return 4;
 }
 // Rotate Accumulator Right
-inline int RRC()
+inline int RRC(Machine &m)
 {
-	CARRY = ((ACC & 0x01) << 7);
-	ACC = ((ACC >> 1) | CARRY);
+	SetCarry(m, ACC & 0x01);
+	ACC = ((ACC >> 1) | (CARRY << 7));
 	PC++;
 	return 4;
 }
 // Rotate Accumulator Left Through Carry
-inline int RAL()
+inline int RAL(Machine &m)
 {
 	int temp = CARRY;
-	CARRY = ((ACC & 0x80) >> 7);
+	SetCarry(m, (ACC & 0x80) >> 7);
 	ACC = ((ACC << 1) | temp);
 	PC++;
 	return 4;
 }
 // Rotate Accumulator Right Through Carry
-inline int RAR()
+inline int RAR(Machine &m)
 {
 	int temp = CARRY;
-	CARRY = ((ACC & 0x01) << 7);
-	ACC = ((ACC >> 1) | CARRY);
+	SetCarry(m, ACC & 0x01);
+	ACC = ((ACC >> 1) | (temp << 7));
 	PC++;
 	return 4;
 }
@@ -351,182 +294,106 @@ inline int RAR()
 
 /********** Register Pair Instructions **********/
 // Push
-inline int PUSH(int RP)
+template <int RP>
+inline int PUSH(Machine &m)
 {
-	if (RP == 3)
-	{
-		// Push (PSW)
-		mem::Write(SP - 1, ACC);
-		mem::Write(SP - 2, GetStatusByte());
-		SP -= 2;
-	}
-	else
-	{
-		int upper_index;
-		switch (RP)
-		{
-		case 0: upper_index = 0; break;
-		case 1: upper_index = 2; break;
-		case 2: upper_index = 4; break;
-		}
-
-		// Push (register pair)
-		mem::Write(SP - 1, i8080.registers[upper_index]);
-		mem::Write(SP - 2, i8080.registers[upper_index + 1]);
-		SP -= 2;
-	}
+	// Push (register pair)
+	StackPush(m, GetPair<RP>(m));
+
+	PC++;
+	return 11;
+}
+template <>
+inline int PUSH<PSW>(Machine &m)
+{
+	// Push (PSW)
+	MaterializeFlags(m);
+	StackPush(m, m.cpu.psw);
 
 	PC++;
 	return 11;
 }
 // Pop
-inline int POP(int RP)
+template <int RP>
+inline int POP(Machine &m)
 {
-	if (RP == 3)
-	{
-		// Pop (PSW)
-		SetStatusBits(mem::Read(SP));
-		ACC = mem::Read(SP + 1);
-		SP += 2;
-	}
-	else
-	{
-		int upper_index;
-		switch (RP)
-		{
-		case 0: upper_index = 0; break;
-		case 1: upper_index = 2; break;
-		case 2: upper_index = 4; break;
-		}
-
-		// Pop (register pair)
-		i8080.registers[upper_index] = mem::Read(SP + 1);
-		i8080.registers[upper_index + 1] = mem::Read(SP);
-		SP += 2;
-	}
+	// Pop (register pair)
+	SetPair<RP>(m, StackPop(m));
+
+	PC++;
+	return 10;
+}
+template <>
+inline int POP<PSW>(Machine &m)
+{
+	// Pop (PSW)
+	u16 psw = StackPop(m);
+	ACC = (psw >> 8);
+	SetStatusBits(m, psw & 0x00FF);
 
 	PC++;
 	return 10;
 }
 // Double Add
-inline int DAD(int RP)
+template <int RP>
+inline int DAD(Machine &m)
 {
-	if (RP == 3)
-	{
-		// TODO: SP !!
-	}
-	else
-	{
-		int upper_index;
-		switch (RP)
-		{
-		case 0: upper_index = 0; break;
-		case 1: upper_index = 2; break;
-		case 2: upper_index = 4; break;
-		}
-
-		u16 RR =
-			((i8080.registers[upper_index] << 8) | i8080.registers[upper_index + 1]);
-		u16 HL = ((i8080.registers[4] << 8) | i8080.registers[5]);
-		u16 temp = RR + HL;
-		i8080.registers[4] = ((temp & 0xFF00) >> 8);
-		i8080.registers[5] = (temp & 0x00FF);
-
-		// Status bits
-		SetCarry(RR, HL);
-	}
+	u32 sum = GetPair<RP>(m) + GetPair<HL>(m);
+	SetPair<HL>(m, sum);
+
+	// Status bits
+	SetCarry(m, sum >> 16);
 
 	PC++;
 	return 10;
 }
 // Increment Register Pair
-inline int INX(int RP)
+template <int RP>
+inline int INX(Machine &m)
 {
-	if (RP == 3)
-	{
-		// TODO: SP !!
-	}
-	else
-	{
-		int upper_index;
-		switch (RP)
-		{
-		case 0: upper_index = 0; break;
-		case 1: upper_index = 2; break;
-		case 2: upper_index = 4; break;
-		}
-
-		u16 temp = // TODO: signed short?
-			((i8080.registers[upper_index] << 8) | i8080.registers[upper_index + 1]) + 1;
-		i8080.registers[upper_index] = ((temp & 0xFF00) >> 8);
-		i8080.registers[upper_index + 1] = (temp & 0x00FF);
-	}
+	SetPair<RP>(m, GetPair<RP>(m) + 1);
 
 	PC++;
 	// No status.
 	return 5;
 }
 // Decrement Register Pair
-inline int DCX(int RP)
+template <int RP>
+inline int DCX(Machine &m)
 {
-	if (RP == 3)
-	{
-		// TODO: SP !!
-	}
-	else
-	{
-		int upper_index;
-		switch (RP)
-		{
-		case 0: upper_index = 0; break;
-		case 1: upper_index = 2; break;
-		case 2: upper_index = 4; break;
-		}
-
-		u16 temp = // TODO: signed short?
-			((i8080.registers[upper_index] << 8) | i8080.registers[upper_index + 1]) - 1;
-		i8080.registers[upper_index] = (temp & 0xFF00);
-		i8080.registers[upper_index + 1] = (temp & 0x00FF);
-	}
+	SetPair<RP>(m, GetPair<RP>(m) - 1);
 
 	PC++;
 	// No status.
 	return 5;
 }
 // Exchange Registers
-inline int XCHG()
+inline int XCHG(Machine &m)
 {
 	// Exchange HL and DE register pairs
-	u8 t1, t2;
-	t1 = i8080.registers[2];
-	t2 = i8080.registers[3];
-	i8080.registers[2] = i8080.registers[4];
-	i8080.registers[3] = i8080.registers[5];
-	i8080.registers[4] = t1;
-	i8080.registers[5] = t2;
+	u16 temp = m.cpu.de;
+	m.cpu.de = m.cpu.hl;
+	m.cpu.hl = temp;
 
 	PC++;
 	// No status.
 	return 5;
 }
 // Exchange Stack
-inline int XTHL()
+inline int XTHL(Machine &m)
 {
 	// Exchange HL register pair with stack
-	u8 t1, t2;
-	t1 = i8080.registers[4];
-	t2 = i8080.registers[5];
-	i8080.registers[4] = mem::Read(SP + 1);
-	i8080.registers[5] = mem::Read(SP);
-	mem::Write(SP + 1, t1);
-	mem::Write(SP, t2);
+	u16 temp = m.cpu.hl;
+	m.cpu.hl = ((mem::Read(m, SP + 1) << 8) | mem::Read(m, SP));
+	mem::Write(m, SP + 1, (temp & 0xFF00) >> 8);
+	mem::Write(m, SP, temp & 0x00FF);
 
 	PC++;
 	// No status.
 	return 18;
 }
 // Load SP from H and L
-inline int SPHL()
+inline int SPHL(Machine &m)
 {
 	SP = H_L;
 	PC++;
@@ -538,173 +405,132 @@ inline int SPHL()
 
 /********** Immediate Instructions **********/
 // Load Immediate Data
-inline int LXI(int RP)
+template <int RP>
+inline int LXI(Machine &m)
 {
-	if (RP == 3)
-	{
-		SP = NextAddress();
-		PC += 3;
-	}
-	else
-	{
-		int upper_index; // TODO: inline
-		switch (RP)
-		{
-		case 0: upper_index = 0; break;
-		case 1: upper_index = 2; break;
-		case 2: upper_index = 4; break;
-		}
-
-		i8080.registers[upper_index + 1] = NextByte();
-		PC++;
-		i8080.registers[upper_index] = NextByte();
-		PC += 2;
-	}
+	SetPair<RP>(m, NextAddress(m));
+
+	PC += 3;
 	// No status.
 	return 10;
 }
 // Move Immedate Data
-inline int MVI(int REG)
+template <int DDD>
+inline int MVI(Machine &m)
 {
-	int cycles;
-
-	if (REG == 3)
-	{
-		mem::Write(H_L, NextByte());
-		cycles = 10;
-	}
-	else
-	{
-		i8080.registers[REG] = NextByte();
-		cycles = 7;
-	}
+	SetOperand<DDD>(m, NextByte(m));
 
 	PC += 2;
 	// No status.
-	return cycles;
+	return (DDD == M) ? 10 : 7;
 }
 // Add Immediate to Accumulator
-inline int ADI()
+inline int ADI(Machine &m)
 {
 	u8 a = ACC;
-	u8 b = mem::Read(++PC);
-	ACC += b;
+	u8 b = NextByte(m);
+	u16 sum = a + b;
+	ACC = sum;
 
 	// Status bits
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
-	SetCarry(a, b);
-	SetAuxCarry(a, b);
+	SetCarry(m, sum >> 8);
+	FlagsAdd(m, a, b, ACC);
 
-	PC++;
+	PC += 2;
 	return 7;
 }
 // Add Immediate to Accumulator with Carry
-inline int ACI()
+inline int ACI(Machine &m)
 {
 	u8 a = ACC;
-	u8 b = mem::Read(++PC) + CARRY;
-	ACC += b;
+	u8 b = NextByte(m);
+	u16 sum = a + b + CARRY;
+	ACC = sum;
 
 	// Status bits
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
-	SetCarry(a, b);
-	SetAuxCarry(a, b);
+	SetCarry(m, sum >> 8);
+	FlagsAdd(m, a, b, ACC);
 
-	PC++;
+	PC += 2;
 	return 7;
 }
 // Subtract Immediate from Accumulator
-inline int SUI()
+inline int SUI(Machine &m)
 {
 	u8 a = ACC;
-	u8 b = -mem::Read(++PC);
-	ACC += b;
+	u8 b = NextByte(m);
+	u16 difference = a - b;
+	ACC = difference;
 
 	// Status bits
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
-	SetBorrow(a, b);
-	SetAuxBorrow(a, b);
+	SetCarry(m, (difference >> 8) & 1);
+	FlagsSub(m, a, b, ACC);
 
-	PC++;
+	PC += 2;
 	return 7;
 }
 // Subtract Immediate from Accumulator with Borrow
-inline int SBI()
+inline int SBI(Machine &m)
 {
 	u8 a = ACC;
-	u8 b = -mem::Read(++PC) + CARRY;
-	ACC += b;
+	u8 b = NextByte(m);
+	u16 difference = a - b - CARRY;
+	ACC = difference;
 
 	// Status bits
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
-	SetBorrow(a, b);
-	SetAuxBorrow(a, b);
+	SetCarry(m, (difference >> 8) & 1);
+	FlagsSub(m, a, b, ACC);
 
-	PC++;
+	PC += 2;
 	return 7;
 }
 // AND Immediate with Accumulator
-inline int ANI()
+inline int ANI(Machine &m)
 {
-	ACC &= NextByte();
+	u8 a = ACC;
+	u8 b = NextByte(m);
+	ACC = a & b;
 
 	// Status bits
-	CARRY = 0;
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
+	SetCarry(m, 0);
+	FlagsAnd(m, a, b, ACC);
 
 	PC += 2;
 	return 7;
 }
 // XOR Immediate with Accumulator
-inline int XRI()
+inline int XRI(Machine &m)
 {
-	ACC ^= NextByte();
+	ACC ^= NextByte(m);
 
 	// Status bits
-	CARRY = 0;
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
+	SetCarry(m, 0);
+	FlagsLogic(m, ACC);
 
 	PC += 2;
 	return 7;
 }
 // OR Immediate with Accumulator
-inline int ORI()
+inline int ORI(Machine &m)
 {
-	ACC |= NextByte();
+	ACC |= NextByte(m);
 
 	// Status bits
-	CARRY = 0;
-	SetZero(ACC);
-	SetSign(ACC);
-	SetParity(ACC);
+	SetCarry(m, 0);
+	FlagsLogic(m, ACC);
 
 	PC += 2;
 	return 7;
 }
 // Compare Immediate with Accumulator
-inline int CPI()
+inline int CPI(Machine &m)
 {
-	u8 num = NextByte();
-	u8 result = ACC - num;
+	u8 num = NextByte(m);
+	u16 difference = ACC - num;
 
 	// Status bits
-	SetZero(result);
-	SetSign(result);
-	SetParity(result);
-	SetBorrow(ACC, num);
-	SetAuxBorrow(ACC, num);
+	SetCarry(m, (difference >> 8) & 1);
+	FlagsSub(m, ACC, num, difference);
 
 	PC += 2;
 	return 7;
@@ -714,40 +540,40 @@ inline int CPI()
 
 /********** Direct Addressing Instructions **********/
 // Store Accumulator Direct
-inline int STA()
+inline int STA(Machine &m)
 {
-	mem::Write(NextAddress(), ACC);
+	mem::Write(m, NextAddress(m), ACC);
 
 	PC += 3;
 	// No status.
 	return 13;
 }
 // Load Accumulator Direct
-inline int LDA()
+inline int LDA(Machine &m)
 {
-	ACC = mem::Read(NextAddress());
+	ACC = mem::Read(m, NextAddress(m));
 
 	PC += 3;
 	// No status.
 	return 13;
 }
 // Store H and L Direct
-inline int SHLD()
+inline int SHLD(Machine &m)
 {
-	u16 addr = NextAddress();
-	mem::Write(addr, i8080.registers[5]);
-	mem::Write(addr + 1, i8080.registers[4]);
+	u16 addr = NextAddress(m);
+	mem::Write(m, addr, m.cpu.l);
+	mem::Write(m, addr + 1, m.cpu.h);
 
 	PC += 3;
 	// No status.
 	return 16;
 }
 // Load H and L Direct
-inline int LHLD()
+inline int LHLD(Machine &m)
 {
-	u16 addr = NextAddress();
-	i8080.registers[5] = mem::Read(addr);
-	i8080.registers[4] = mem::Read(addr + 1);
+	u16 addr = NextAddress(m);
+	m.cpu.l = mem::Read(m, addr);
+	m.cpu.h = mem::Read(m, addr + 1);
 
 	PC += 3;
 	// No status.
@@ -758,96 +584,96 @@ inline int LHLD()
 
 /********** Jump Instructions **********/
 // Load Program Counter
-inline int PCHL()
+inline int PCHL(Machine &m)
 {
-	PC = ((i8080.registers[4] << 8) | i8080.registers[5]);
+	PC = H_L;
 	// No status.
 	return 5;
 }
 // Jump
-inline int JMP()
+inline int JMP(Machine &m)
 {
-	Jump();
+	Jump(m);
 	// No status.
 	return 10;
 }
 // Jump if Carry
-inline int JC()
+inline int JC(Machine &m)
 {
-	if (CARRY)
-		Jump();
+	if (GetCarry(m))
+		Jump(m);
 	else
 		PC += 3;
 	// No status.
 	return 10;
 }
 // Jump if No Carry
-inline int JNC()
+inline int JNC(Machine &m)
 {
-	if (CARRY)
+	if (GetCarry(m))
 		PC += 3;
 	else
-		Jump();
+		Jump(m);
 	// No status.
 	return 10;
 }
 // Jump if Zero
-inline int JZ()
+inline int JZ(Machine &m)
 {
-	if (ZERO)
-		Jump();
+	if (GetZero(m))
+		Jump(m);
 	else
 		PC += 3;
 	// No status.
 	return 10;
 }
 // Jump if Not Zero
-inline int JNZ()
+inline int JNZ(Machine &m)
 {
-	if (ZERO != 0)
+	if (GetZero(m))
 		PC += 3;
 	else
-		Jump();
+		Jump(m);
 	// No status.
 	return 10;
 }
 // Jump if Minus
-inline int JM()
+inline int JM(Machine &m)
 {
-	if (SIGN)
-		Jump();
+	if (GetSign(m))
+		Jump(m);
 	else
 		PC += 3;
 	// No status.
 	return 10;
 }
 // Jump if Positive
-inline int JP()
+inline int JP(Machine &m)
 {
-	if (SIGN)
+	if (GetSign(m))
 		PC += 3;
 	else
-		Jump();
+		Jump(m);
 	// No status.
 	return 10;
 }
 // Jump if Parity Even
-inline int JPE()
+inline int JPE(Machine &m)
 {
-	if (PARITY)
-		Jump();
+	if (GetParity(m))
+		Jump(m);
 	else
 		PC += 3;
 	// No status.
 	return 10;
 }
 // Jump if Parity Odd
-inline int JPO()
+inline int JPO(Machine &m)
 {
-	if (PARITY)
+	if (GetParity(m))
 		PC += 3;
 	else
-		Jump();
+		Jump(m);
 	// No status.
 	return 10;
 }
@@ -856,81 +682,81 @@ inline int JPO()
 
 /********** Call Subroutine Instructions **********/
 // Call
-inline int CALL()
+inline int CALL(Machine &m)
 {
-	Call();
+	Call(m);
 	return 17;
 }
 // Call if Carry
-inline int CC()
+inline int CC(Machine &m)
 {
-	if (CARRY)
-		Call();
+	if (GetCarry(m))
+		Call(m);
 	else
 		PC += 3;
 	return 17;
 }
 // Call if No Carry
-inline int CNC()
+inline int CNC(Machine &m)
 {
-	if (CARRY)
+	if (GetCarry(m))
 		PC += 3;
 	else
-		Call();
+		Call(m);
 	return 17;
 }
 // Call if Zero
-inline int CZ()
+inline int CZ(Machine &m)
 {
-	if (ZERO)
-		Call();
+	if (GetZero(m))
+		Call(m);
 	else
 		PC += 3;
 	return 17;
 }
 // Call if Not Zero
-inline int CNZ()
+inline int CNZ(Machine &m)
 {
-	if (ZERO)
+	if (GetZero(m))
 		PC += 3;
 	else
-		Call();
+		Call(m);
 	return 17;
 }
 // Call if Minus
-inline int CM()
+inline int CM(Machine &m)
 {
-	if (SIGN)
-		Call();
+	if (GetSign(m))
+		Call(m);
 	else
 		PC += 3;
 	return 17;
 }
 // Call if Plus
-inline int CP()
+inline int CP(Machine &m)
 {
-	if (SIGN)
+	if (GetSign(m))
 		PC += 3;
 	else
-		Call();
+		Call(m);
 	return 17;
 }
 // Call if Parity Even
-inline int CPE()
+inline int CPE(Machine &m)
 {
-	if (PARITY)
-		Call();
+	if (GetParity(m))
+		Call(m);
 	else
 		PC += 3;
 	return 17;
 }
 // Call if Parity Odd
-inline int CPO()
+inline int CPO(Machine &m)
 {
-	if (PARITY)
+	if (GetParity(m))
 		PC += 3;
 	else
-		Call();
+		Call(m);
 	return 17;
 }
 
@@ -938,81 +764,81 @@ inline int CPO()
 
 /********** Return from Subroutine Instructions **********/
 // Return
-inline int RET()
+inline int RET(Machine &m)
 {
-	PC = StackPop();
+	PC = StackPop(m);
 	return 10;
 }
 // Return if Carry
-inline int RC()
+inline int RC(Machine &m)
 {
-	if (CARRY)
-		PC = StackPop();
+	if (GetCarry(m))
+		PC = StackPop(m);
 	else
 		PC++;
 	return 11;
 }
 // Return if No Carry
-inline int RNC()
+inline int RNC(Machine &m)
 {
-	if (CARRY)
+	if (GetCarry(m))
 		PC++;
 	else
-		PC = StackPop();
+		PC = StackPop(m);
 	return 11;
 }
 // Return if Zero
-inline int RZ()
+inline int RZ(Machine &m)
 {
-	if (ZERO)
-		PC = StackPop();
+	if (GetZero(m))
+		PC = StackPop(m);
 	else
 		PC++;
 	return 11;
 }
 // Return if Not Zero
-inline int RNZ()
+inline int RNZ(Machine &m)
 {
-	if (ZERO)
+	if (GetZero(m))
 		PC++;
 	else
-		PC = StackPop();
+		PC = StackPop(m);
 	return 11;
 }
 // Return if Minus
-inline int RM()
+inline int RM(Machine &m)
 {
-	if (SIGN)
-		PC = StackPop();
+	if (GetSign(m))
+		PC = StackPop(m);
 	else
 		PC++;
 	return 11;
 }
 // Return if Plus
-inline int RP()
+inline int RP(Machine &m)
 {
-	if (SIGN)
+	if (GetSign(m))
 		PC++;
 	else
-		PC = StackPop();
+		PC = StackPop(m);
 	return 11;
 }
 // Return if Parity Even
-inline int RPE()
+inline int RPE(Machine &m)
 {
-	if (PARITY)
-		PC = StackPop();
+	if (GetParity(m))
+		PC = StackPop(m);
 	else
 		PC++;
 	return 11;
 }
 // Return if Parity Odd
-inline int RPO()
+inline int RPO(Machine &m)
 {
-	if (PARITY)
+	if (GetParity(m))
 		PC++;
 	else
-		PC = StackPop();
+		PC = StackPop(m);
 	return 11;
 }
 
@@ -1020,10 +846,12 @@ inline int RPO()
 
 /* RST Instruction */
 // Restart
-inline int RST(int EXP)
+template <int EXP>
+inline int RST(Machine &m)
 {
-	StackPush(PC + 1);
+	StackPush(m, PC + 1);
 	PC = (EXP << 3);
+	PROFILE_CALL(PC);
 	return 11;
 }
 
@@ -1031,16 +859,16 @@ inline int RST(int EXP)
 
 /********** Interrupt Flip-flop Instructions **********/
 // Enable Interrupts
-inline int EI()
+inline int EI(Machine &m)
 {
-	i8080.INTE = 1;
+	m.cpu.INTE = 1;
 	PC++;
 	return 4;
 }
 // Disable Interrupts
-inline int DI()
+inline int DI(Machine &m)
 {
-	i8080.INTE = 0;
+	m.cpu.INTE = 0;
 	PC++;
 	return 4;
 }
@@ -1049,16 +877,16 @@ inline int DI()
 
 /********** I/O Instructions **********/
 // Input
-inline int IN()
+inline int IN(Machine &m)
 {
-	ACC = Input(NextByte());
+	ACC = Input(m, NextByte(m));
 	PC += 2;
 	return 10;
 }
 // Output
-inline int OUT()
+inline int OUT(Machine &m)
 {
-	Output(NextByte(), ACC);
+	Output(m, NextByte(m), ACC);
 	PC += 2;
 	return 10;
 }
@@ -1066,11 +894,11 @@ inline int OUT()
 
 
 /* HLT Halt Instruction */
-// Halt
-inline int HLT()
+// Halt: the cores burn the rest of their budget until an interrupt
+inline int HLT(Machine &m)
 {
-	// unnecessary
-
+	PC++;
+	m.halted = true;
 	return 7;
 }
 
@@ -2,211 +2,366 @@
 #define PROCESSOR_H
 
 #include "common.h"
+#include "machine.h"
 #include "memory.h"
-
+#include "profiler.h"
 
 #include <iostream>
 
-struct state
-{
-	u8 registers[8];	// B, C, D, E, H, L, _, A
-	u16 pc;				// program counter
-	u16 sp;				// stack pointer
-	int status[5];		// status: S, Z, P, C, AC
-	bool IE;
+// Register (SSS/DDD) and register pair (RP) operand fields
+enum Register { B, C, D, E, H, L, M, A };
+enum RegisterPair { BC, DE, HL, SP_PAIR, PSW = SP_PAIR };
 
-	bool INTE;
-};
-extern state i8080;
+#ifdef DECODE_CACHE
+
+// Returns next byte of memory, as decoded when the instruction was fetched
+inline u8 NextByte(Machine &m)
+{
+	return (u8)m.decode_cache[PC].operand;
+}
 
-#define SP		i8080.sp
-#define PC		i8080.pc
-#define REGISTER		i8080.registers
-#define STAT	i8080.status
+// Returns the next address in memory, as decoded when the instruction was fetched
+inline u16 NextAddress(Machine &m)
+{
+	return m.decode_cache[PC].operand;
+}
 
-extern u8 dipswitch_1;
-extern u8 dipswitch_2;
-extern u16 shift_register;
-extern u16 shift_offset;
+#else
 
 // Returns next byte of memory
-inline u8 NextByte()
+inline u8 NextByte(Machine &m)
 {
-	return mem::Read(PC + 1);
+	return mem::Read(m, PC + 1);
 }
 
 // Returns next two bytes of memory
-inline u16 NextShort()
+inline u16 NextShort(Machine &m)
 {
-	int value = ((mem::Read(PC + 1) << 8) | mem::Read(PC + 2));
+	int value = ((mem::Read(m, PC + 1) << 8) | mem::Read(m, PC + 2));
 	PC += 2;
 	return value;
 }
 
 // Returns the next address in memory
-inline u16 NextAddress()
+inline u16 NextAddress(Machine &m)
 {
-	int address = ((mem::Read(PC + 2) << 8) | mem::Read(PC + 1));
+	int address = ((mem::Read(m, PC + 2) << 8) | mem::Read(m, PC + 1));
 	return address;
 }
 
-// Gets the status byte
-inline u8 GetStatusByte()
-{
-	// S-Z-0-AC-0-P-1-C
-	return ((STAT[0] << 7) | (STAT[1] << 6) | (STAT[4] << 4) | (STAT[2] << 2) | 0x2 | STAT[3]);
-}
-
-// Sets the status bits
-inline void SetStatusBits(u8 status)
-{
-	// status: S, Z, P, C, AC
-	STAT[0] = ((status & 0x80) >> 7);
-	STAT[1] = ((status & 0x40) >> 6);
-	STAT[2] = ((status & 0x04) >> 2);
-	STAT[3] = (status & 0x01);
-	STAT[4] = ((status & 0x10) >> 4);
-}
+#endif
 
 // Push to the stack
-inline void StackPush(u16 data)
+inline void StackPush(Machine &m, u16 data)
 {
-	mem::Write(SP - 1, data & 0x00FF);
-	mem::Write(SP - 2, (data & 0xFF00) >> 8);
+	mem::Write(m, SP - 1, (data & 0xFF00) >> 8);
+	mem::Write(m, SP - 2, data & 0x00FF);
 	SP -= 2;
 }
 
 // Pop from the stack
-inline u16 StackPop()
+inline u16 StackPop(Machine &m)
 {
-	u16 addr = ((mem::Read(SP) << 8) | mem::Read(SP + 1));
+	u16 addr = ((mem::Read(m, SP + 1) << 8) | mem::Read(m, SP));
 	SP += 2;
 	return addr;
 }
 
 // Jump
-inline void Jump()
+inline void Jump(Machine &m)
 {
-	PC = NextAddress();
+	PC = NextAddress(m);
 }
 
 // Call
-inline void Call()
+inline void Call(Machine &m)
+{
+	StackPush(m, PC + 3);
+	Jump(m);
+	PROFILE_CALL(PC);
+}
+
+// Interrupt
+inline void GenerateInterrupt(Machine &m, int addr)
 {
-	StackPush(PC + 3);
-	Jump();
+	StackPush(m, PC);
+	PC = addr;
+	m.halted = false;
+	PROFILE_CALL(addr);
 }
 
-inline u8 Input(u8 port)
+inline u8 Input(Machine &m, u8 port)
 {
+	PROFILE_INPUT(port);
 	switch (port)
 	{
 	case 1:
-		return dipswitch_1;
+		return m.dipswitch_1;
 	case 2:
-		return dipswitch_2;
+		return m.dipswitch_2;
 	case 3:
 		// Shift register result
-		return ((shift_register << shift_offset) >> 8);
+		return ((m.shift_register << m.shift_offset) >> 8);
 		break;
 	}
 
 	return 0;
 }
 
-inline void Output(u8 port, u8 reg)
+inline void Output(Machine &m, u8 port, u8 reg)
 {
+	PROFILE_OUTPUT(port);
 	switch (port)
 	{
 	case 2:
 		// Shift register result offset
-		shift_offset = (reg & 0x7);
+		m.shift_offset = (reg & 0x7);
 		break;
 	case 4:
 		// Fill shift register
-		shift_register = ((shift_register << 8) | reg);
+		m.shift_register = ((m.shift_register << 8) | reg);
 		break;
 	}
 }
 
 /********* Status Byte Functions *********/
 
-inline void SetZero(u16 num)
+// Returns 1 if num has an even number of set bits
+constexpr int Parity(u8 num)
 {
-	i8080.status[1] = (num == 0) ? 1 : 0;
+	int parity = 1;
+	while (num)
+	{
+		parity = !parity;
+		num &= (num - 1);
+	}
+	return parity;
 }
 
-inline void SetSign(u16 num)
+struct FlagTable
+{
+	u8 flags[256];
+};
+
+constexpr FlagTable MakeSZPTable()
 {
-	i8080.status[0] = (num >> 7);
+	FlagTable table = {};
+	for (int i = 0; i < 256; i++)
+		table.flags[i] = (i & FLAG_S) | ((i == 0) ? FLAG_Z : 0) | (Parity(i) ? FLAG_P : 0) | FLAG_1;
+	return table;
 }
 
-inline void SetParity(u16 num)
+// Sign, zero and parity of every result byte
+constexpr FlagTable szp_table = MakeSZPTable();
+
+// Carry out of bit 3, indexed by bit 3 of both operands and of the result.
+// The 8080 subtracts by adding the complement, so subtraction has its own table.
+constexpr u8 aux_carry_add[8] = { 0, 0, FLAG_AC, 0, FLAG_AC, 0, FLAG_AC, FLAG_AC };
+constexpr u8 aux_carry_sub[8] = { FLAG_AC, 0, 0, 0, FLAG_AC, FLAG_AC, FLAG_AC, 0 };
+
+// Operation that last set S, Z, P and AC
+enum FlagOp { FLAG_OP_NONE, FLAG_OP_ADD, FLAG_OP_SUB, FLAG_OP_AND, FLAG_OP_LOGIC };
+
+// Aux carry bit for the operation that produced result from a and b
+inline u8 AuxCarry(u8 op, u8 a, u8 b, u8 result)
 {
-	int parity = 0;
-	while (num)
+	int index = ((a & 0x08) >> 1) | ((b & 0x08) >> 2) | ((result & 0x08) >> 3);
+
+	switch (op)
 	{
-		parity = !parity;
-		num &= (num - 1);
+	case FLAG_OP_ADD: return aux_carry_add[index];
+	case FLAG_OP_SUB: return aux_carry_sub[index];
+	case FLAG_OP_AND: return ((a | b) & 0x08) << 1;
 	}
-	i8080.status[2] = (parity) ? 0 : 1;
+	return 0;
 }
 
-template <typename T>
-inline void SetCarry(T num1, T num2)
+// Sets or clears carry, leaving the other flags alone
+inline void SetCarry(Machine &m, int carry)
 {
-	int res1 = num1 + num2;
-	T res2 = num1 + num2;
+	m.cpu.flags = (m.cpu.flags & ~FLAG_C) | carry;
+}
+
+#ifdef LAZY_FLAGS
 
-	i8080.status[3] = (res1 == res2) ? 0 : 1;
+// Lazy flags: only the operation is recorded, S, Z, P and AC are derived
+// from it when an instruction actually reads them. Carry stays eager.
+inline void RecordFlags(Machine &m, u8 op, u8 a, u8 b, u8 result)
+{
+	m.cpu.lazy_op = op;
+	m.cpu.lazy_a = a;
+	m.cpu.lazy_b = b;
+	m.cpu.lazy_result = result;
 }
 
-template <typename T>
-inline void SetAuxCarry(T num1, T num2)
+inline void MaterializeFlags(Machine &m)
 {
-	int byte1 = (num1 & 0xFF);
-	T byte2 = ((num2 & 0xFF) & 0xFF);
+	if (m.cpu.lazy_op == FLAG_OP_NONE)
+		return;
 
-	int res1 = byte1 + byte2;
-	T res2 = byte1 + byte2;
+	m.cpu.flags = (m.cpu.flags & FLAG_C) | szp_table.flags[m.cpu.lazy_result] |
+		AuxCarry(m.cpu.lazy_op, m.cpu.lazy_a, m.cpu.lazy_b, m.cpu.lazy_result);
+	m.cpu.lazy_op = FLAG_OP_NONE;
+}
 
-	i8080.status[4] = (res1 == res2) ? 0 : 1;
+inline int GetSign(Machine &m)
+{
+	return (m.cpu.lazy_op != FLAG_OP_NONE) ? (szp_table.flags[m.cpu.lazy_result] & FLAG_S) : SIGN;
 }
 
-template <typename T>
-inline void SetBorrow(T num1, T num2)
+inline int GetZero(Machine &m)
 {
-	int res1 = num1 + num2;
-	T res2 = num1 + num2;
+	return (m.cpu.lazy_op != FLAG_OP_NONE) ? (szp_table.flags[m.cpu.lazy_result] & FLAG_Z) : ZERO;
+}
 
-	i8080.status[3] = (res1 == res2) ? 1 : 0;
+inline int GetParity(Machine &m)
+{
+	return (m.cpu.lazy_op != FLAG_OP_NONE) ? (szp_table.flags[m.cpu.lazy_result] & FLAG_P) : PARITY;
 }
 
-template <typename T>
-inline void SetAuxBorrow(T num1, T num2)
+inline int GetAuxCarry(Machine &m)
 {
-	int byte1 = (num1 & 0xFF);
-	T byte2 = ((num2 & 0xFF) & 0xFF);
+	MaterializeFlags(m);
+	return AUX_CARRY;
+}
 
-	int res1 = byte1 + byte2;
-	T res2 = byte1 + byte2;
+#else
 
-	i8080.status[4] = (res1 == res2) ? 1 : 0;
+inline void RecordFlags(Machine &m, u8 op, u8 a, u8 b, u8 result)
+{
+	m.cpu.flags = (m.cpu.flags & FLAG_C) | szp_table.flags[result] | AuxCarry(op, a, b, result);
+}
+
+inline void MaterializeFlags(Machine &m)
+{
+}
+
+inline int GetSign(Machine &m)
+{
+	return SIGN;
+}
+
+inline int GetZero(Machine &m)
+{
+	return ZERO;
+}
+
+inline int GetParity(Machine &m)
+{
+	return PARITY;
+}
+
+inline int GetAuxCarry(Machine &m)
+{
+	return AUX_CARRY;
+}
+
+#endif
+
+inline int GetCarry(Machine &m)
+{
+	return CARRY;
+}
+
+// S, Z, P and AC after result = a + b (+ carry)
+inline void FlagsAdd(Machine &m, u8 a, u8 b, u8 result)
+{
+	RecordFlags(m, FLAG_OP_ADD, a, b, result);
+}
+
+// S, Z, P and AC after result = a - b (- borrow)
+inline void FlagsSub(Machine &m, u8 a, u8 b, u8 result)
+{
+	RecordFlags(m, FLAG_OP_SUB, a, b, result);
+}
+
+// S, Z, P and AC after result = a & b
+inline void FlagsAnd(Machine &m, u8 a, u8 b, u8 result)
+{
+	RecordFlags(m, FLAG_OP_AND, a, b, result);
+}
+
+// S, Z, P and AC after OR or XOR
+inline void FlagsLogic(Machine &m, u8 result)
+{
+	RecordFlags(m, FLAG_OP_LOGIC, 0, 0, result);
+}
+
+// Gets the status byte
+inline u8 GetStatusByte(Machine &m)
+{
+	MaterializeFlags(m);
+	return m.cpu.flags;
+}
+
+// Sets the status bits
+inline void SetStatusBits(Machine &m, u8 status)
+{
+	// Bits 5 and 3 always read 0, bit 1 always reads 1
+	m.cpu.flags = (status & (FLAG_S | FLAG_Z | FLAG_AC | FLAG_P | FLAG_C)) | FLAG_1;
+#ifdef LAZY_FLAGS
+	m.cpu.lazy_op = FLAG_OP_NONE;
+#endif
 }
 
 /********** Operand functions *********/
 
-inline int ROMTA_Operand(int RP)
+// Storage of each register operand
+template <int R> u8 &Register8(Machine &m);
+template <> inline u8 &Register8<B>(Machine &m) { return m.cpu.b; }
+template <> inline u8 &Register8<C>(Machine &m) { return m.cpu.c; }
+template <> inline u8 &Register8<D>(Machine &m) { return m.cpu.d; }
+template <> inline u8 &Register8<E>(Machine &m) { return m.cpu.e; }
+template <> inline u8 &Register8<H>(Machine &m) { return m.cpu.h; }
+template <> inline u8 &Register8<L>(Machine &m) { return m.cpu.l; }
+template <> inline u8 &Register8<A>(Machine &m) { return m.cpu.a; }
+
+// Storage of each register pair operand; SP_PAIR is the stack pointer
+template <int RP> u16 &Register16(Machine &m);
+template <> inline u16 &Register16<BC>(Machine &m) { return m.cpu.bc; }
+template <> inline u16 &Register16<DE>(Machine &m) { return m.cpu.de; }
+template <> inline u16 &Register16<HL>(Machine &m) { return m.cpu.hl; }
+template <> inline u16 &Register16<SP_PAIR>(Machine &m) { return m.cpu.sp; }
+
+// Register or memory operand; M addresses memory through HL
+template <int R>
+inline u8 GetOperand(Machine &m)
+{
+	return Register8<R>(m);
+}
+template <>
+inline u8 GetOperand<M>(Machine &m)
+{
+	return mem::Read(m, H_L);
+}
+
+template <int R>
+inline void SetOperand(Machine &m, u8 value)
+{
+	Register8<R>(m) = value;
+}
+template <>
+inline void SetOperand<M>(Machine &m, u8 value)
+{
+	mem::Write(m, H_L, value);
+}
+
+// Register pair operand
+template <int RP>
+inline u16 GetPair(Machine &m)
+{
+	return Register16<RP>(m);
+}
+
+template <int RP>
+inline void SetPair(Machine &m, u16 value)
 {
-	if (RP == 6)
-		return mem::Read(H_L);
-	else
-		return i8080.registers[RP];
+	Register16<RP>(m) = value;
 }
 
 /********** Other functions **********/
 
-void InitializeCPU();
-u16 GetPC();
+// Resets the CPU registers, leaving memory and I/O alone
+void InitializeCPU(Machine &m);
 
 #endif /*PROCESSOR_H*/
@@ -0,0 +1,135 @@
+#include "profiler.h"
+
+#ifdef PROFILE
+
+#include "memory.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+namespace profiler
+{
+	u64 opcode_count[0x100];
+	u64 opcode_cycles[0x100];
+	u64 pc_count[0x10000];
+	u64 call_count[0x10000];
+	u64 input_count[0x100];
+	u64 output_count[0x100];
+
+	// Undocumented duplicates are starred
+	const char *const mnemonics[0x100] =
+	{
+		"NOP", "LXI B", "STAX B", "INX B", "INR B", "DCR B", "MVI B", "RLC",
+		"*NOP", "DAD B", "LDAX B", "DCX B", "INR C", "DCR C", "MVI C", "RRC",
+		"*NOP", "LXI D", "STAX D", "INX D", "INR D", "DCR D", "MVI D", "RAL",
+		"*NOP", "DAD D", "LDAX D", "DCX D", "INR E", "DCR E", "MVI E", "RAR",
+		"*NOP", "LXI H", "SHLD", "INX H", "INR H", "DCR H", "MVI H", "DAA",
+		"*NOP", "DAD H", "LHLD", "DCX H", "INR L", "DCR L", "MVI L", "CMA",
+		"*NOP", "LXI SP", "STA", "INX SP", "INR M", "DCR M", "MVI M", "STC",
+		"*NOP", "DAD SP", "LDA", "DCX SP", "INR A", "DCR A", "MVI A", "CMC",
+		"MOV B,B", "MOV B,C", "MOV B,D", "MOV B,E", "MOV B,H", "MOV B,L", "MOV B,M", "MOV B,A",
+		"MOV C,B", "MOV C,C", "MOV C,D", "MOV C,E", "MOV C,H", "MOV C,L", "MOV C,M", "MOV C,A",
+		"MOV D,B", "MOV D,C", "MOV D,D", "MOV D,E", "MOV D,H", "MOV D,L", "MOV D,M", "MOV D,A",
+		"MOV E,B", "MOV E,C", "MOV E,D", "MOV E,E", "MOV E,H", "MOV E,L", "MOV E,M", "MOV E,A",
+		"MOV H,B", "MOV H,C", "MOV H,D", "MOV H,E", "MOV H,H", "MOV H,L", "MOV H,M", "MOV H,A",
+		"MOV L,B", "MOV L,C", "MOV L,D", "MOV L,E", "MOV L,H", "MOV L,L", "MOV L,M", "MOV L,A",
+		"MOV M,B", "MOV M,C", "MOV M,D", "MOV M,E", "MOV M,H", "MOV M,L", "HLT", "MOV M,A",
+		"MOV A,B", "MOV A,C", "MOV A,D", "MOV A,E", "MOV A,H", "MOV A,L", "MOV A,M", "MOV A,A",
+		"ADD B", "ADD C", "ADD D", "ADD E", "ADD H", "ADD L", "ADD M", "ADD A",
+		"ADC B", "ADC C", "ADC D", "ADC E", "ADC H", "ADC L", "ADC M", "ADC A",
+		"SUB B", "SUB C", "SUB D", "SUB E", "SUB H", "SUB L", "SUB M", "SUB A",
+		"SBB B", "SBB C", "SBB D", "SBB E", "SBB H", "SBB L", "SBB M", "SBB A",
+		"ANA B", "ANA C", "ANA D", "ANA E", "ANA H", "ANA L", "ANA M", "ANA A",
+		"XRA B", "XRA C", "XRA D", "XRA E", "XRA H", "XRA L", "XRA M", "XRA A",
+		"ORA B", "ORA C", "ORA D", "ORA E", "ORA H", "ORA L", "ORA M", "ORA A",
+		"CMP B", "CMP C", "CMP D", "CMP E", "CMP H", "CMP L", "CMP M", "CMP A",
+		"RNZ", "POP B", "JNZ", "JMP", "CNZ", "PUSH B", "ADI", "RST 0",
+		"RZ", "RET", "JZ", "*JMP", "CZ", "CALL", "ACI", "RST 1",
+		"RNC", "POP D", "JNC", "OUT", "CNC", "PUSH D", "SUI", "RST 2",
+		"RC", "*RET", "JC", "IN", "CC", "*CALL", "SBI", "RST 3",
+		"RPO", "POP H", "JPO", "XTHL", "CPO", "PUSH H", "ANI", "RST 4",
+		"RPE", "PCHL", "JPE", "XCHG", "CPE", "*CALL", "XRI", "RST 5",
+		"RP", "POP PSW", "JP", "DI", "CP", "PUSH PSW", "ORI", "RST 6",
+		"RM", "SPHL", "JM", "EI", "CM", "*CALL", "CPI", "RST 7",
+	};
+
+	void Reset()
+	{
+		memset(opcode_count, 0, sizeof(opcode_count));
+		memset(opcode_cycles, 0, sizeof(opcode_cycles));
+		memset(pc_count, 0, sizeof(pc_count));
+		memset(call_count, 0, sizeof(call_count));
+		memset(input_count, 0, sizeof(input_count));
+		memset(output_count, 0, sizeof(output_count));
+	}
+
+	// Indices of the nonzero entries of counts, largest first, at most limit of them
+	std::vector<int> Ranked(const u64 *counts, int size, int limit)
+	{
+		std::vector<int> ranked;
+		for (int i = 0; i < size; i++)
+		{
+			if (counts[i] != 0)
+				ranked.push_back(i);
+		}
+
+		std::stable_sort(ranked.begin(), ranked.end(), [counts](int a, int b) { return counts[a] > counts[b]; });
+		if ((int)ranked.size() > limit)
+			ranked.resize(limit);
+		return ranked;
+	}
+
+	bool WriteReport(const Machine &m, const char *path)
+	{
+		FILE *f = fopen(path, "w");
+		if (f == NULL)
+			return false;
+
+		u64 instructions = 0, cycles = 0, calls = 0;
+		for (int i = 0; i < 0x100; i++)
+		{
+			instructions += opcode_count[i];
+			cycles += opcode_cycles[i];
+		}
+		for (int i = 0; i < 0x10000; i++)
+			calls += call_count[i];
+
+		fprintf(f, "%llu instructions, %llu cycles\n", (unsigned long long)instructions, (unsigned long long)cycles);
+
+		// Opcodes, by share of emulated time
+		fprintf(f, "\nopcode,mnemonic,count,cycles,cycle_share\n");
+		for (int op : Ranked(opcode_cycles, 0x100, 0x100))
+		{
+			fprintf(f, "%02X,%s,%llu,%llu,%.3f%%\n", op, mnemonics[op], (unsigned long long)opcode_count[op],
+				(unsigned long long)opcode_cycles[op], 100.0 * opcode_cycles[op] / cycles);
+		}
+
+		// Opcodes at hot PCs are read at report time, so code in RAM shows what is there now
+		fprintf(f, "\npc,opcode,count,share\n");
+		for (int pc : Ranked(pc_count, 0x10000, 64))
+		{
+			fprintf(f, "%04X,%s,%llu,%.3f%%\n", pc, mnemonics[mem::Read(m, pc)], (unsigned long long)pc_count[pc],
+				100.0 * pc_count[pc] / instructions);
+		}
+
+		fprintf(f, "\ncall_target,count,share\n");
+		for (int target : Ranked(call_count, 0x10000, 32))
+		{
+			fprintf(f, "%04X,%llu,%.3f%%\n", target, (unsigned long long)call_count[target], 100.0 * call_count[target] / calls);
+		}
+
+		fprintf(f, "\nport,reads,writes\n");
+		for (int port = 0; port < 0x100; port++)
+		{
+			if (input_count[port] || output_count[port])
+				fprintf(f, "%d,%llu,%llu\n", port, (unsigned long long)input_count[port], (unsigned long long)output_count[port]);
+		}
+
+		fclose(f);
+		return true;
+	}
+}
+
+#endif
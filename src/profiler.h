@@ -0,0 +1,74 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "common.h"
+
+// Instrumentation mode (-DPROFILE): counts executions and cycles per opcode,
+// executions per PC, CALL and RST targets and I/O port accesses. Without
+// PROFILE the hooks below expand to nothing.
+
+#ifdef PROFILE
+
+struct Machine;
+
+#define PROFILE_INSTRUCTION(opcode, pc) profiler::Instruction(opcode, pc)
+#define PROFILE_CYCLES(opcode, cycles) profiler::Cycles(opcode, cycles)
+#define PROFILE_CALL(target) profiler::Call(target)
+#define PROFILE_INPUT(port) profiler::Input(port)
+#define PROFILE_OUTPUT(port) profiler::Output(port)
+
+namespace profiler
+{
+	extern u64 opcode_count[0x100];
+	extern u64 opcode_cycles[0x100];
+	extern u64 pc_count[0x10000];
+	extern u64 call_count[0x10000];
+	extern u64 input_count[0x100];
+	extern u64 output_count[0x100];
+
+	inline void Instruction(u8 opcode, u16 pc)
+	{
+		opcode_count[opcode]++;
+		pc_count[pc]++;
+	}
+
+	// Returns cycles so it can wrap the handler call
+	inline int Cycles(u8 opcode, int cycles)
+	{
+		opcode_cycles[opcode] += cycles;
+		return cycles;
+	}
+
+	inline void Call(u16 target)
+	{
+		call_count[target]++;
+	}
+
+	inline void Input(u8 port)
+	{
+		input_count[port]++;
+	}
+
+	inline void Output(u8 port)
+	{
+		output_count[port]++;
+	}
+
+	void Reset();
+
+	// Writes the sorted report, naming hot PCs after the opcodes in m;
+	// returns false if the file cannot be created
+	bool WriteReport(const Machine &m, const char *path);
+}
+
+#else
+
+#define PROFILE_INSTRUCTION(opcode, pc)
+#define PROFILE_CYCLES(opcode, cycles) (cycles)
+#define PROFILE_CALL(target)
+#define PROFILE_INPUT(port)
+#define PROFILE_OUTPUT(port)
+
+#endif
+
+#endif /*PROFILER_H*/
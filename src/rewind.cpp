@@ -0,0 +1,136 @@
+#include "rewind.h"
+#include "decode.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+
+static_assert(RAM_PAGES == 32, "RewindEntry::pages has one bit per RAM page");
+
+#define ALL_PAGES 0xFFFFFFFFu
+#define FIRST_RAM_PAGE (RAM_START / RAM_PAGE_SIZE)
+
+inline RewindEntry &Entry(RewindBuffer &r, long long frame)
+{
+	return r.entries[frame % r.entries.size()];
+}
+
+inline u8 *Slot(RewindBuffer &r, long long slot)
+{
+	return &r.pool[(slot % r.slots) * RAM_PAGE_SIZE];
+}
+
+inline int CountPages(u32 pages)
+{
+	return (int)std::bitset<32>(pages).count();
+}
+
+// Drops the oldest keyframe and the deltas that depend on it
+void DropOldestGroup(RewindBuffer &r)
+{
+	do
+		r.first++;
+	while (r.first < r.next && Entry(r, r.first).pages != ALL_PAGES);
+}
+
+void InitializeRewind(RewindBuffer &r, int frames, int keyframe_interval, long long max_bytes)
+{
+	r.entries.assign(std::max(frames, 1), RewindEntry());
+	r.slots = std::max(max_bytes / RAM_PAGE_SIZE, 2LL * RAM_PAGES);
+	r.pool.assign(r.slots * RAM_PAGE_SIZE, 0);
+	r.keyframe_interval = std::max(keyframe_interval, 1);
+
+	r.first = r.next = r.keyframe = r.next_slot = 0;
+	r.frames_recorded = r.keyframes_recorded = r.pages_recorded = 0;
+}
+
+void RecordFrame(RewindBuffer &r, Machine &m)
+{
+	long long capacity = r.entries.size();
+
+	u32 dirty = 0;
+	for (int page = 0; page < RAM_PAGES; page++)
+	{
+		u8 &flags = m.dirty_pages[FIRST_RAM_PAGE + page];
+		if (flags & DIRTY_REWIND)
+			dirty |= 1u << page;
+		flags &= ~DIRTY_REWIND;
+	}
+
+	// A delta may only push out groups older than its own keyframe; if its
+	// group alone would overflow the buffer it becomes a keyframe instead
+	bool keyframe = (r.next == r.first) || (r.next - r.keyframe >= r.keyframe_interval);
+	if (!keyframe)
+	{
+		long long group_frames = r.next - r.keyframe;
+		long long group_slots = r.next_slot - Entry(r, r.keyframe).slot;
+		keyframe = (group_frames + 1 > capacity) || (group_slots + CountPages(dirty) > r.slots);
+	}
+
+	u32 pages = keyframe ? ALL_PAGES : dirty;
+	int count = CountPages(pages);
+	while (r.next > r.first && (r.next - r.first >= capacity || r.next_slot + count - Entry(r, r.first).slot > r.slots))
+		DropOldestGroup(r);
+
+	RewindEntry &entry = Entry(r, r.next);
+	SaveRegisters(m, entry.registers);
+	entry.pages = pages;
+	entry.slot = r.next_slot;
+	for (int page = 0; page < RAM_PAGES; page++)
+		if (pages & (1u << page))
+			memcpy(Slot(r, r.next_slot++), m.memory + RAM_START + page * RAM_PAGE_SIZE, RAM_PAGE_SIZE);
+
+	if (pages == ALL_PAGES)
+	{
+		r.keyframe = r.next;
+		r.keyframes_recorded++;
+	}
+	r.next++;
+	r.frames_recorded++;
+	r.pages_recorded += count;
+}
+
+bool Rewind(RewindBuffer &r, Machine &m, int frames)
+{
+	long long target = r.next - 1 - frames;
+	if (frames < 0 || target < r.first)
+		return false;
+
+	// Newest copy of each page at or before the target; the walk ends at a
+	// keyframe at the latest, and the oldest frame held is always one
+	u32 restored = 0;
+	for (long long frame = target; restored != ALL_PAGES; frame--)
+	{
+		const RewindEntry &entry = Entry(r, frame);
+		long long slot = entry.slot;
+		for (int page = 0; page < RAM_PAGES; page++)
+		{
+			if (!(entry.pages & (1u << page)))
+				continue;
+			if (!(restored & (1u << page)))
+				memcpy(m.memory + RAM_START + page * RAM_PAGE_SIZE, Slot(r, slot), RAM_PAGE_SIZE);
+			slot++;
+		}
+		restored |= entry.pages;
+	}
+
+	const RewindEntry &entry = Entry(r, target);
+	RestoreRegisters(m, entry.registers);
+	FlushDecodedPages(m, FIRST_RAM_PAGE, FIRST_RAM_PAGE + RAM_PAGES - 1);
+	for (int page = 0; page < RAM_PAGES; page++)
+		m.dirty_pages[FIRST_RAM_PAGE + page] = (u8)~DIRTY_REWIND;	// changed for everyone but the buffer
+
+	// Recording carries on from the target
+	r.next = target + 1;
+	r.next_slot = entry.slot + CountPages(entry.pages);
+	for (r.keyframe = target; Entry(r, r.keyframe).pages != ALL_PAGES; r.keyframe--)
+		;
+	return true;
+}
+
+double AverageBytesPerFrame(const RewindBuffer &r)
+{
+	if (r.frames_recorded == 0)
+		return 0;
+	return (double)(r.pages_recorded * RAM_PAGE_SIZE + r.frames_recorded * sizeof(RewindEntry)) / r.frames_recorded;
+}
@@ -0,0 +1,65 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "common.h"
+#include "machine.h"
+#include "savestate.h"
+
+#include <vector>
+
+// Rewind buffer: one entry per recorded frame in a ring. A keyframe stores
+// every RAM page, the frames after it only the pages mem::Write dirtied
+// since the frame before. Page contents go to a fixed pool of page slots
+// used in ring order; when the ring or the pool is full the oldest keyframe
+// and its deltas are dropped together. All storage is allocated once.
+
+#define RAM_PAGE_SIZE 0x100
+#define RAM_PAGES (RAM_SIZE / RAM_PAGE_SIZE)
+
+struct RewindEntry
+{
+	MachineRegisters registers;
+	u32 pages;			// RAM pages stored, one bit each
+	long long slot;		// pool slot of the first of them; the rest follow
+};
+
+struct RewindBuffer
+{
+	std::vector<RewindEntry> entries;
+	std::vector<u8> pool;	// slots of RAM_PAGE_SIZE bytes
+	long long slots;
+	int keyframe_interval;
+
+	long long first, next;	// frame numbers held: first up to next - 1
+	long long keyframe;		// latest keyframe held
+	long long next_slot;	// pool slot the next frame's pages go to
+
+	// Statistics over every frame recorded
+	long long frames_recorded;
+	long long keyframes_recorded;
+	long long pages_recorded;
+};
+
+// Sizes the buffer for frames frames with a keyframe at least every
+// keyframe_interval frames, in no more than max_bytes of page storage
+// (at least two keyframes' worth is always kept)
+void InitializeRewind(RewindBuffer &r, int frames, int keyframe_interval, long long max_bytes);
+
+// Records the machine as it is now, normally once per frame
+void RecordFrame(RewindBuffer &r, Machine &m);
+
+// Puts the machine back frames recorded frames before the latest one (0 is
+// the latest one itself) and forgets the frames after it. Returns false,
+// leaving the machine alone, if the buffer does not reach that far.
+bool Rewind(RewindBuffer &r, Machine &m, int frames);
+
+// Frames held; Rewind() reaches back RewindDepth() - 1 frames
+inline int RewindDepth(const RewindBuffer &r)
+{
+	return (int)(r.next - r.first);
+}
+
+// Average storage taken per recorded frame, registers included
+double AverageBytesPerFrame(const RewindBuffer &r);
+
+#endif /*REWIND_H*/
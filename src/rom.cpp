@@ -0,0 +1,165 @@
+#include "rom.h"
+#include "decode.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+const RomBank rom_banks[ROM_BANKS] =
+{
+	{ "invaders.h", 0x734f5ad8 },
+	{ "invaders.g", 0x6bfaca4a },
+	{ "invaders.f", 0x0ccead96 },
+	{ "invaders.e", 0x14e538b0 },
+};
+
+/********** CRC32 **********/
+
+// Reflected, polynomial 0xEDB88320, as used by zip and the ROM databases
+struct CrcTable
+{
+	u32 entries[256];
+
+	CrcTable()
+	{
+		for (u32 i = 0; i < 256; i++)
+		{
+			u32 crc = i;
+			for (int bit = 0; bit < 8; bit++)
+				crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+			entries[i] = crc;
+		}
+	}
+};
+
+const CrcTable crc_table;
+
+u32 Crc32(const u8 *data, size_t size)
+{
+	u32 crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; i++)
+		crc = crc_table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+int CheckRom(const u8 *rom)
+{
+	int bad_banks = 0;
+	for (int bank = 0; bank < ROM_BANKS; bank++)
+		if (Crc32(rom + bank * ROM_BANK_SIZE, ROM_BANK_SIZE) != rom_banks[bank].crc)
+			bad_banks |= 1 << bank;
+	return bad_banks;
+}
+
+/********** Reading **********/
+
+inline bool IsDirectory(const char *path)
+{
+	struct stat info;
+	return stat(path, &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+}
+
+// Reads the file at path into data; it must hold exactly size bytes
+bool ReadExactly(const char *path, u8 *data, size_t size)
+{
+	struct stat info;
+	if (stat(path, &info) != 0 || (size_t)info.st_size != size)
+		return false;
+
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return false;
+	bool read = fread(data, 1, size, f) == size;
+	fclose(f);
+	return read;
+}
+
+// Reads a directory of banks or a combined image into rom
+bool ReadRomSet(const char *path, u8 *rom)
+{
+	if (!IsDirectory(path))
+		return ReadExactly(path, rom, ROM_SIZE);
+
+	for (int bank = 0; bank < ROM_BANKS; bank++)
+	{
+		std::string file = std::string(path) + "/" + rom_banks[bank].name;
+		if (!ReadExactly(file.c_str(), rom + bank * ROM_BANK_SIZE, ROM_BANK_SIZE))
+			return false;
+	}
+	return true;
+}
+
+bool LoadRom(Machine &m, const char *path)
+{
+	// Straight into ROM, so nothing decoded from it may survive
+	if (!ReadRomSet(path, m.memory))
+		return false;
+	m.rom = m.memory;
+	MapMemory(m);
+	FlushDecodeCache(m);
+	DecodeRom(m);
+	return true;
+}
+
+/********** Shared images **********/
+
+bool OpenRomImage(RomImage &image, const char *path)
+{
+	image.data = NULL;
+	image.mapping = NULL;
+	image.buffer = NULL;
+
+#ifndef _WIN32
+	struct stat info;
+	if (!IsDirectory(path) && stat(path, &info) == 0 && info.st_size == ROM_SIZE)
+	{
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		void *mapping = mmap(NULL, ROM_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapping != MAP_FAILED)
+		{
+			image.mapping = mapping;
+			image.data = (const u8*)mapping;
+			return true;
+		}
+	}
+#endif
+
+	image.buffer = new u8[ROM_SIZE];
+	if (!ReadRomSet(path, image.buffer))
+	{
+		CloseRomImage(image);
+		return false;
+	}
+	image.data = image.buffer;
+	return true;
+}
+
+void CloseRomImage(RomImage &image)
+{
+#ifndef _WIN32
+	if (image.mapping != NULL)
+		munmap(image.mapping, ROM_SIZE);
+#endif
+	delete[] image.buffer;
+	image.data = NULL;
+	image.mapping = NULL;
+	image.buffer = NULL;
+}
+
+void AttachRom(Machine &m, const RomImage &image)
+{
+	m.rom = image.data;
+	MapMemory(m);
+	FlushDecodeCache(m);
+	DecodeRom(m);
+}
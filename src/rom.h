@@ -0,0 +1,52 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include "common.h"
+#include "machine.h"
+
+#include <cstddef>
+
+// ROM loading. The Space Invaders ROM set is four 2 KB banks, invaders.h,
+// .g, .f and .e from 0x0000 up, found either as those files in a directory
+// or as one image of all four in that order. Each bank is read once,
+// straight to where it is kept. Sizes must be exact; a bank whose CRC32
+// differs from the known dump still loads, so patched sets and homebrew
+// run, but CheckRom() tells.
+
+#define ROM_BANK_SIZE 0x800
+#define ROM_BANKS (ROM_SIZE / ROM_BANK_SIZE)
+
+struct RomBank
+{
+	const char *name;
+	u32 crc;				// of the known-good dump
+};
+
+extern const RomBank rom_banks[ROM_BANKS];
+
+u32 Crc32(const u8 *data, size_t size);
+
+// One bit per bank of rom (ROM_SIZE bytes) that is not the known dump
+int CheckRom(const u8 *rom);
+
+// Loads the set at path, a directory or a combined image, into the
+// machine's own ROM and decodes it
+bool LoadRom(Machine &m, const char *path);
+
+// A ROM set loaded once for any number of machines: a read-only mapping of
+// a combined image where the system has one, else a single heap copy
+struct RomImage
+{
+	const u8 *data;			// ROM_SIZE bytes
+	void *mapping;			// data, if it is mapped
+	u8 *buffer;				// data, if it is read
+};
+
+bool OpenRomImage(RomImage &image, const char *path);
+void CloseRomImage(RomImage &image);
+
+// Points the machine's ROM pages at image, which must outlive it, and
+// decodes it. Nothing is copied, and CopyMachine() keeps the image shared.
+void AttachRom(Machine &m, const RomImage &image);
+
+#endif /*ROM_H*/
@@ -0,0 +1,169 @@
+#include "savestate.h"
+#include "decode.h"
+#include "dispatch.h"
+#include "processor.h"
+
+#include <cstdio>
+#include <cstring>
+
+const char save_state_magic[6] = { 'I', '8', '0', '8', '0', 'S' };
+
+// Bits of the status byte in the file
+#define SAVED_INTE 0x01
+#define SAVED_IE 0x02
+#define SAVED_INTERRUPT_SWITCH 0x04	// version 1: RST 2 due next
+#define SAVED_RUNNING 0x08
+#define SAVED_HALTED 0x10
+
+void SaveRegisters(Machine &m, MachineRegisters &registers)
+{
+	GetStatusByte(m);
+	registers.cpu = m.cpu;
+	registers.dipswitch_1 = m.dipswitch_1;
+	registers.dipswitch_2 = m.dipswitch_2;
+	registers.shift_register = m.shift_register;
+	registers.shift_offset = m.shift_offset;
+	registers.cycles = m.cycles;
+	registers.running = m.running;
+	registers.halted = m.halted;
+}
+
+void RestoreRegisters(Machine &m, const MachineRegisters &registers)
+{
+	m.cpu = registers.cpu;
+	m.dipswitch_1 = registers.dipswitch_1;
+	m.dipswitch_2 = registers.dipswitch_2;
+	m.shift_register = registers.shift_register;
+	m.shift_offset = registers.shift_offset;
+	m.cycles = registers.cycles;
+	m.running = registers.running;
+	m.halted = registers.halted;
+}
+
+void SaveMachine(Machine &m, SaveState &snapshot)
+{
+	SaveRegisters(m, snapshot.registers);
+	memcpy(snapshot.ram, m.memory + RAM_START, RAM_SIZE);
+}
+
+void RestoreMachine(Machine &m, const SaveState &snapshot)
+{
+	RestoreRegisters(m, snapshot.registers);
+	memcpy(m.memory + RAM_START, snapshot.ram, RAM_SIZE);
+	memset(m.dirty_pages + (RAM_START >> 8), 0xFF, RAM_SIZE >> 8);
+	FlushDecodedPages(m, RAM_START >> 8, (RAM_START + RAM_SIZE - 1) >> 8);
+}
+
+/********** File form **********/
+
+inline u8 *Put16(u8 *p, u16 value)
+{
+	p[0] = value & 0xFF;
+	p[1] = value >> 8;
+	return p + 2;
+}
+
+inline const u8 *Get16(const u8 *p, u16 &value)
+{
+	value = p[0] | (p[1] << 8);
+	return p + 2;
+}
+
+inline u8 *Put64(u8 *p, u64 value)
+{
+	for (int i = 0; i < 8; i++)
+		p[i] = (u8)(value >> (8 * i));
+	return p + 8;
+}
+
+inline const u8 *Get64(const u8 *p, u64 &value)
+{
+	value = 0;
+	for (int i = 0; i < 8; i++)
+		value |= (u64)p[i] << (8 * i);
+	return p + 8;
+}
+
+bool WriteSaveState(const SaveState &snapshot, const char *path)
+{
+	u8 buffer[SAVE_STATE_FILE_SIZE];
+	const MachineRegisters &registers = snapshot.registers;
+	const state &cpu = registers.cpu;
+	u8 *p = buffer;
+
+	memcpy(p, save_state_magic, sizeof(save_state_magic));
+	p = Put16(p + sizeof(save_state_magic), SAVE_STATE_VERSION);
+
+	const u8 bytes[] = { cpu.b, cpu.c, cpu.d, cpu.e, cpu.h, cpu.l, cpu.a, cpu.flags };
+	memcpy(p, bytes, sizeof(bytes));
+	p = Put16(p + sizeof(bytes), cpu.pc);
+	p = Put16(p, cpu.sp);
+	*p++ = (cpu.INTE ? SAVED_INTE : 0) | (cpu.IE ? SAVED_IE : 0) | (registers.running ? SAVED_RUNNING : 0) |
+		(registers.halted ? SAVED_HALTED : 0);
+	*p++ = registers.dipswitch_1;
+	*p++ = registers.dipswitch_2;
+	p = Put16(p, registers.shift_register);
+	p = Put16(p, registers.shift_offset);
+	p = Put64(p, registers.cycles);
+	memcpy(p, snapshot.ram, RAM_SIZE);
+
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return false;
+	bool written = fwrite(buffer, 1, sizeof(buffer), f) == sizeof(buffer);
+	return (fclose(f) == 0) && written;
+}
+
+bool ReadSaveState(SaveState &snapshot, const char *path)
+{
+	u8 buffer[SAVE_STATE_FILE_SIZE + 1];
+	u16 version;
+
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return false;
+	size_t size = fread(buffer, 1, sizeof(buffer), f);
+	fclose(f);
+	if (size < 8 || memcmp(buffer, save_state_magic, sizeof(save_state_magic)))
+		return false;
+	const u8 *p = Get16(buffer + sizeof(save_state_magic), version);
+	if (!(version == SAVE_STATE_VERSION && size == SAVE_STATE_FILE_SIZE) &&
+		!(version == 1 && size == SAVE_STATE_V1_FILE_SIZE))
+		return false;
+
+	MachineRegisters &registers = snapshot.registers;
+	state &cpu = registers.cpu;
+	memset(&cpu, 0, sizeof(cpu));
+	cpu.b = *p++;
+	cpu.c = *p++;
+	cpu.d = *p++;
+	cpu.e = *p++;
+	cpu.h = *p++;
+	cpu.l = *p++;
+	cpu.a = *p++;
+	cpu.flags = (*p++ & (FLAG_S | FLAG_Z | FLAG_AC | FLAG_P | FLAG_C)) | FLAG_1;
+	p = Get16(p, cpu.pc);
+	p = Get16(p, cpu.sp);
+	u8 status = *p++;
+	cpu.INTE = (status & SAVED_INTE) != 0;
+	cpu.IE = (status & SAVED_IE) != 0;
+	registers.running = (status & SAVED_RUNNING) != 0;
+	registers.halted = (status & SAVED_HALTED) != 0;
+	registers.dipswitch_1 = *p++;
+	registers.dipswitch_2 = *p++;
+	p = Get16(p, registers.shift_register);
+	p = Get16(p, registers.shift_offset);
+	if (version == 1)
+	{
+		// Taken on a half-frame boundary; only which one is known
+		registers.cycles = (status & SAVED_INTERRUPT_SWITCH) ? HALF_FRAME_CYCLES : 0;
+	}
+	else
+	{
+		u64 cycles;
+		p = Get64(p, cycles);
+		registers.cycles = (long long)cycles;
+	}
+	memcpy(snapshot.ram, p, RAM_SIZE);
+	return true;
+}
@@ -0,0 +1,53 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include "common.h"
+#include "machine.h"
+
+// Save states: everything in a Machine that changes while it runs. That is
+// the CPU, RAM, the shift register, the dipswitches and the cycle count,
+// which fixes the interrupt phase.
+// ROM is left out, so a state only makes sense in a machine with the same
+// ROM loaded.
+
+#define SAVE_STATE_VERSION 2
+#define SAVE_STATE_FILE_SIZE (8 + 27 + RAM_SIZE)	// header, registers and I/O, RAM
+#define SAVE_STATE_V1_FILE_SIZE (8 + 19 + RAM_SIZE)	// no cycle count; still read
+
+// Everything in a save state but RAM
+struct MachineRegisters
+{
+	state cpu;
+	u8 dipswitch_1;
+	u8 dipswitch_2;
+	u16 shift_register;
+	u16 shift_offset;
+	long long cycles;
+	bool running;
+	bool halted;
+};
+
+struct SaveState
+{
+	MachineRegisters registers;
+	u8 ram[RAM_SIZE];
+};
+
+// Copy the registers alone, for callers that keep RAM their own way
+void SaveRegisters(Machine &m, MachineRegisters &registers);
+void RestoreRegisters(Machine &m, const MachineRegisters &registers);
+
+// Copies the machine into snapshot; settles lazy flags first
+void SaveMachine(Machine &m, SaveState &snapshot);
+
+// Puts the machine back as it was when snapshot was taken. Allocates nothing
+// and only drops the decoded instructions that lie in RAM. RAM counts as
+// written for every consumer of dirty pages.
+void RestoreMachine(Machine &m, const SaveState &snapshot);
+
+// File form: a versioned little-endian layout that does not depend on the
+// build's flag mode or struct padding
+bool WriteSaveState(const SaveState &snapshot, const char *path);
+bool ReadSaveState(SaveState &snapshot, const char *path);
+
+#endif /*SAVESTATE_H*/
@@ -0,0 +1,102 @@
+#include "scheduler.h"
+#include "dispatch.h"
+
+#include <cstddef>
+#include <utility>
+
+/********** Heap **********/
+
+inline bool Earlier(const ScheduledEvent &a, const ScheduledEvent &b)
+{
+	return a.deadline < b.deadline || (a.deadline == b.deadline && a.order < b.order);
+}
+
+void SiftUp(Scheduler &s, int i)
+{
+	while (i > 0 && Earlier(s.events[i], s.events[(i - 1) / 2]))
+	{
+		std::swap(s.events[i], s.events[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+}
+
+void SiftDown(Scheduler &s, int i)
+{
+	for (;;)
+	{
+		int earliest = i;
+		for (int child = 2 * i + 1; child <= 2 * i + 2 && child < s.count; child++)
+			if (Earlier(s.events[child], s.events[earliest]))
+				earliest = child;
+		if (earliest == i)
+			return;
+		std::swap(s.events[i], s.events[earliest]);
+		i = earliest;
+	}
+}
+
+/********** Events **********/
+
+void InitializeScheduler(Scheduler &s)
+{
+	s.count = 0;
+	s.scheduled = 0;
+}
+
+bool ScheduleEvent(Scheduler &s, long long deadline, long long period, EventHandler handler, void *context)
+{
+	if (s.count == MAX_EVENTS)
+		return false;
+
+	s.events[s.count] = { deadline, period, handler, context, s.scheduled++ };
+	SiftUp(s, s.count++);
+	return true;
+}
+
+void MidScreen(Machine &m, void *context)
+{
+	MidScreenInterrupt(m);
+}
+
+void Vblank(Machine &m, void *context)
+{
+	VblankInterrupt(m);
+}
+
+void ScheduleInterrupts(Scheduler &s, const Machine &m)
+{
+	ScheduleEvent(s, NextDeadline(m, FRAME_CYCLES, HALF_FRAME_CYCLES), FRAME_CYCLES, MidScreen, NULL);
+	ScheduleEvent(s, NextDeadline(m, FRAME_CYCLES, 0), FRAME_CYCLES, Vblank, NULL);
+}
+
+long long NextDeadline(const Machine &m, long long period, long long phase)
+{
+	// A deadline the machine stands on has passed: EmulateHalfFrame() and
+	// RunToNextEvent() fire what is due there before returning
+	long long periods = (m.cycles - phase) / period + 1;
+	if (m.cycles < phase)
+		periods = 0;
+	return periods * period + phase;
+}
+
+int RunToNextEvent(Scheduler &s, Machine &m)
+{
+	if (s.count == 0)
+		return 0;
+
+	int instructions = 0;
+	if (m.cycles < s.events[0].deadline)
+		instructions = Emulate8080(m, (int)(s.events[0].deadline - m.cycles));
+
+	while (s.count > 0 && s.events[0].deadline <= m.cycles)
+	{
+		ScheduledEvent event = s.events[0];
+		if (event.period > 0)
+			s.events[0].deadline += event.period;
+		else
+			s.events[0] = s.events[--s.count];
+		SiftDown(s, 0);
+		event.handler(m, event.context);
+	}
+	return instructions;
+}
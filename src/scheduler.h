@@ -0,0 +1,54 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "common.h"
+#include "machine.h"
+
+// Cycle-timed events: the interrupts, and whatever a front end needs done at
+// a given point of the frame (video handoff, input, sound). Deadlines are in
+// Machine::cycles and kept in a small min-heap. RunToNextEvent() runs the
+// core straight to the earliest one, so the core checks nothing per
+// instruction beyond its cycle budget. The instruction that crosses a
+// deadline completes first; a periodic event is then due again a period
+// after its deadline, not after the overshoot, so timing never drifts.
+// Events due at the same cycle fire in the order they were scheduled.
+
+#define MAX_EVENTS 8
+
+typedef void (*EventHandler)(Machine &m, void *context);
+
+struct ScheduledEvent
+{
+	long long deadline;
+	long long period;		// 0 for an event that fires once
+	EventHandler handler;
+	void *context;
+	int order;				// breaks ties on deadline
+};
+
+struct Scheduler
+{
+	ScheduledEvent events[MAX_EVENTS];	// heap, earliest deadline first
+	int count;
+	int scheduled;			// events ever scheduled, for ScheduledEvent::order
+};
+
+void InitializeScheduler(Scheduler &s);
+
+// Adds an event due at deadline, then every period cycles if period > 0.
+// Returns false if the scheduler is full.
+bool ScheduleEvent(Scheduler &s, long long deadline, long long period, EventHandler handler, void *context);
+
+// Adds the mid-screen and vblank interrupts from the machine's next
+// half-frame boundary on
+void ScheduleInterrupts(Scheduler &s, const Machine &m);
+
+// First cycle after m.cycles where an event with the given period and
+// phase (offset into the period) is due
+long long NextDeadline(const Machine &m, long long period, long long phase);
+
+// Runs the machine to the earliest deadline and fires every event then due;
+// returns instructions executed
+int RunToNextEvent(Scheduler &s, Machine &m);
+
+#endif /*SCHEDULER_H*/
@@ -0,0 +1,265 @@
+#include "video.h"
+
+#include <cstring>
+
+// Bytes of VRAM per block of columns
+#define BLOCK_BYTES (CONVERT_BLOCK * VRAM_COLUMN_BYTES)
+
+/********** Conversion kernels **********/
+
+// Each kernel converts columns x to x + CONVERT_BLOCK - 1, reading them from
+// vram and writing them to rows of the frame. Bit t of column byte b is row
+// HEIGHT - 1 - (8 * b + t).
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+// 16 x 16 byte transpose within each 128-bit half: four rounds of
+// interleaving row i with row i + 8
+inline void Transpose(__m256i *r)
+{
+	__m256i t[16];
+	for (int round = 0; round < 4; round++)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			t[2 * i] = _mm256_unpacklo_epi8(r[i], r[i + 8]);
+			t[2 * i + 1] = _mm256_unpackhi_epi8(r[i], r[i + 8]);
+		}
+		memcpy(r, t, sizeof(t));
+	}
+}
+
+// Sixteen pixels from the low 16 bits of mask, bit 0 leftmost
+inline void ExpandRow(u32 mask, u32 *pixels)
+{
+	const __m256i select = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	const __m256i on = _mm256_set1_epi32(PIXEL_ON);
+	for (int i = 0; i < 2; i++)
+	{
+		__m256i bits = _mm256_and_si256(_mm256_set1_epi32(mask >> (8 * i)), select);
+		__m256i lit = _mm256_cmpeq_epi32(bits, select);
+		_mm256_storeu_si256((__m256i*)(pixels + 8 * i), _mm256_and_si256(lit, on));
+	}
+}
+
+// One register per column, its two halves byte 0-15 and byte 16-31. After
+// the transpose register b holds byte b of every column in its low half and
+// byte b + 16 in its high half; movemask then reads a bit of each as a row.
+inline void ConvertBlock(const u8 *vram, int x, u32 *pixels)
+{
+	__m256i r[16];
+	for (int i = 0; i < 16; i++)
+		r[i] = _mm256_loadu_si256((const __m256i*)(vram + (x + i) * VRAM_COLUMN_BYTES));
+	Transpose(r);
+
+	for (int b = 0; b < 16; b++)
+	{
+		__m256i bytes = r[b];
+		for (int t = 7; t >= 0; t--)
+		{
+			u32 mask = (u32)_mm256_movemask_epi8(bytes);
+			ExpandRow(mask & 0xFFFF, pixels + (HEIGHT - 1 - (8 * b + t)) * WIDTH + x);
+			ExpandRow(mask >> 16, pixels + (HEIGHT - 1 - (8 * (b + 16) + t)) * WIDTH + x);
+			bytes = _mm256_add_epi8(bytes, bytes);	// next bit to the top
+		}
+	}
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+#include <emmintrin.h>
+
+// 16 x 16 byte transpose: four rounds of interleaving row i with row i + 8
+inline void Transpose(__m128i *r)
+{
+	__m128i t[16];
+	for (int round = 0; round < 4; round++)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			t[2 * i] = _mm_unpacklo_epi8(r[i], r[i + 8]);
+			t[2 * i + 1] = _mm_unpackhi_epi8(r[i], r[i + 8]);
+		}
+		memcpy(r, t, sizeof(t));
+	}
+}
+
+// Sixteen pixels from the low 16 bits of mask, bit 0 leftmost
+inline void ExpandRow(u32 mask, u32 *pixels)
+{
+	const __m128i select = _mm_setr_epi32(1, 2, 4, 8);
+	const __m128i on = _mm_set1_epi32(PIXEL_ON);
+	for (int i = 0; i < 4; i++)
+	{
+		__m128i bits = _mm_and_si128(_mm_set1_epi32(mask >> (4 * i)), select);
+		__m128i lit = _mm_cmpeq_epi32(bits, select);
+		_mm_storeu_si128((__m128i*)(pixels + 4 * i), _mm_and_si128(lit, on));
+	}
+}
+
+// Each half of the columns is transposed on its own, so that register b
+// holds byte b of every column; movemask then reads a bit of each as a row
+inline void ConvertBlock(const u8 *vram, int x, u32 *pixels)
+{
+	for (int half = 0; half < 2; half++)
+	{
+		__m128i r[16];
+		for (int i = 0; i < 16; i++)
+			r[i] = _mm_loadu_si128((const __m128i*)(vram + (x + i) * VRAM_COLUMN_BYTES + 16 * half));
+		Transpose(r);
+
+		for (int b = 16 * half; b < 16 * half + 16; b++)
+		{
+			__m128i bytes = r[b - 16 * half];
+			for (int t = 7; t >= 0; t--)
+			{
+				ExpandRow((u32)_mm_movemask_epi8(bytes), pixels + (HEIGHT - 1 - (8 * b + t)) * WIDTH + x);
+				bytes = _mm_add_epi8(bytes, bytes);	// next bit to the top
+			}
+		}
+	}
+}
+
+#else
+
+// Row by row, so the block's pixels are written in order and its VRAM stays
+// in cache
+inline void ConvertBlock(const u8 *vram, int x, u32 *pixels)
+{
+	for (int y = 0; y < HEIGHT; y++)
+	{
+		int k = HEIGHT - 1 - y;
+		const u8 *byte = vram + x * VRAM_COLUMN_BYTES + (k >> 3);
+		u32 *row = pixels + y * WIDTH + x;
+		for (int i = 0; i < CONVERT_BLOCK; i++)
+			row[i] = ((byte[i * VRAM_COLUMN_BYTES] >> (k & 7)) & 1) ? PIXEL_ON : PIXEL_OFF;
+	}
+}
+
+#endif
+
+static_assert(WIDTH % CONVERT_BLOCK == 0, "WIDTH must be a multiple of CONVERT_BLOCK");
+
+void ConvertFrame(const Machine &m, u32 *pixels)
+{
+	for (int x = 0; x < WIDTH; x += CONVERT_BLOCK)
+		ConvertBlock(m.memory + VRAM_START, x, pixels);
+}
+
+void ConvertFrameReference(const Machine &m, u32 *pixels)
+{
+	for (int y = 0; y < HEIGHT; y++)
+		for (int x = 0; x < WIDTH; x++)
+		{
+			int k = HEIGHT - 1 - y;
+			u8 byte = m.memory[VRAM_START + x * VRAM_COLUMN_BYTES + k / 8];
+			pixels[y * WIDTH + x] = (byte & (1 << (k % 8))) ? PIXEL_ON : PIXEL_OFF;
+		}
+}
+
+/********** Dirty tracking **********/
+
+void InitializeVideoFrame(VideoFrame &frame, u32 *pixels)
+{
+	frame.pixels = pixels;
+	frame.valid = false;
+	frame.first_changed = frame.last_changed = 0;
+}
+
+// Converts the blocks of vram that differ from the last update, looking
+// only at those whose bit is set in check
+static bool UpdateBlocks(VideoFrame &frame, const u8 *vram, u32 check)
+{
+	int first = WIDTH, last = -1;
+
+	for (int offset = 0; offset < VRAM_SIZE; offset += BLOCK_BYTES)
+	{
+		if (frame.valid && !(check & (1u << (offset / BLOCK_BYTES))))
+			continue;
+
+		// Marks cover whole pages, and sprite routines often rewrite a byte
+		// with the value it held
+		if (frame.valid && !memcmp(frame.vram + offset, vram + offset, BLOCK_BYTES))
+			continue;
+
+		int x = offset / VRAM_COLUMN_BYTES;
+		memcpy(frame.vram + offset, vram + offset, BLOCK_BYTES);
+		ConvertBlock(vram, x, frame.pixels);
+		if (first > x)
+			first = x;
+		last = x + CONVERT_BLOCK - 1;
+	}
+
+	frame.valid = true;
+	if (last < 0)
+		return false;
+	frame.first_changed = first;
+	frame.last_changed = last;
+	return true;
+}
+
+bool UpdateFrame(Machine &m, VideoFrame &frame)
+{
+	u32 check = 0;
+	for (int page = VRAM_START >> 8; page < MEMORY_SIZE >> 8; page++)
+	{
+		if (m.dirty_pages[page] & DIRTY_VIDEO)
+			check |= 1u << (((page << 8) - VRAM_START) / BLOCK_BYTES);
+		m.dirty_pages[page] &= ~DIRTY_VIDEO;
+	}
+	return UpdateBlocks(frame, m.memory + VRAM_START, check);
+}
+
+bool UpdateFrame(VideoFrame &frame, const u8 *vram)
+{
+	return UpdateBlocks(frame, vram, ~0u);
+}
+
+bool TakeVideoChanges(Machine &m)
+{
+	bool changed = false;
+	for (int page = VRAM_START >> 8; page < MEMORY_SIZE >> 8; page++)
+	{
+		changed |= (m.dirty_pages[page] & DIRTY_VIDEO) != 0;
+		m.dirty_pages[page] &= ~DIRTY_VIDEO;
+	}
+	return changed;
+}
+
+/********** Frame exchange **********/
+
+void InitializeExchange(FrameExchange &exchange)
+{
+	memset(exchange.vram, 0, sizeof(exchange.vram));
+	memset(exchange.tags, 0, sizeof(exchange.tags));
+	exchange.back = 0;
+	exchange.shared = 1;
+	exchange.front = 2;
+	exchange.published = exchange.dropped = 0;
+}
+
+void PublishFrame(FrameExchange &exchange, const Machine &m, u32 tag)
+{
+	memcpy(exchange.vram[exchange.back], m.memory + VRAM_START, VRAM_SIZE);
+	exchange.tags[exchange.back] = tag;
+
+	// Release the copy, acquire the buffer the other side handed back
+	int previous = exchange.shared.exchange(exchange.back | FRAME_FRESH, std::memory_order_acq_rel);
+	if (previous & FRAME_FRESH)
+		exchange.dropped++;
+	exchange.back = previous & ~FRAME_FRESH;
+	exchange.published++;
+}
+
+const u8 *TakeFrame(FrameExchange &exchange)
+{
+	// Only the machine side sets FRAME_FRESH, so once seen it stays set
+	if (!(exchange.shared.load(std::memory_order_relaxed) & FRAME_FRESH))
+		return NULL;
+
+	int previous = exchange.shared.exchange(exchange.front, std::memory_order_acq_rel);
+	exchange.front = previous & ~FRAME_FRESH;
+	return exchange.vram[exchange.front];
+}
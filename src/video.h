@@ -0,0 +1,100 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include "common.h"
+#include "machine.h"
+
+#include <atomic>
+
+#define WIDTH 224
+#define HEIGHT 256
+
+// VRAM holds the frame rotated: one column of HEIGHT pixels every
+// VRAM_COLUMN_BYTES bytes, from the bottom up, bit 0 first
+#define VRAM_START 0x2400
+#define VRAM_SIZE (MEMORY_SIZE - VRAM_START)
+#define VRAM_COLUMN_BYTES (HEIGHT / 8)
+
+#define PIXEL_ON 0x00ffffff
+#define PIXEL_OFF 0
+
+// Columns converted together; WIDTH is a multiple of it
+#define CONVERT_BLOCK 16
+
+#if defined(__AVX2__)
+#define VIDEO_KERNEL "avx2"
+#elif defined(__SSE2__) || defined(_M_X64)
+#define VIDEO_KERNEL "sse2"
+#else
+#define VIDEO_KERNEL "scalar"
+#endif
+
+// Expands VRAM (0x2400-0x3FFF) into an upright WIDTH x HEIGHT 32-bit frame
+// with the SSE2 or AVX2 kernel the build targets, or the scalar one
+void ConvertFrame(const Machine &m, u32 *pixels);
+
+// Pixel-at-a-time conversion the kernels must match bit for bit
+void ConvertFrameReference(const Machine &m, u32 *pixels);
+
+// A frame kept in step with VRAM one block of columns at a time
+struct VideoFrame
+{
+	u32 *pixels;
+	u8 vram[VRAM_SIZE];		// VRAM as last converted
+	bool valid;				// false until the first update has converted everything
+	int first_changed;		// columns converted by the last update
+	int last_changed;
+};
+
+void InitializeVideoFrame(VideoFrame &frame, u32 *pixels);
+
+// Converts the blocks of columns that changed since the last update. Only
+// pages mem::Write marked DIRTY_VIDEO are looked at, and their marks are
+// cleared. Returns false if nothing changed.
+bool UpdateFrame(Machine &m, VideoFrame &frame);
+
+// The same from a copy of VRAM, comparing every block
+bool UpdateFrame(VideoFrame &frame, const u8 *vram);
+
+// Clears the DIRTY_VIDEO marks; returns whether VRAM was written since the
+// last call
+bool TakeVideoChanges(Machine &m);
+
+/********** Frame exchange **********/
+
+// Lock-free triple buffer of VRAM copies between the thread running the
+// machine and the one presenting it. Each side owns one buffer and swaps it
+// for the shared one with a single atomic exchange, so neither ever waits.
+// A copy replaced before it was taken is dropped.
+
+#define FRAME_FRESH 4	// in FrameExchange::shared: published and not yet taken
+
+struct FrameExchange
+{
+	u8 vram[3][VRAM_SIZE];
+	u32 tags[3];				// passed to PublishFrame() with each copy
+	std::atomic<int> shared;	// buffer neither side holds, plus FRAME_FRESH
+	int back;					// buffer the machine side fills
+	int front;					// buffer the presenting side reads
+
+	// Kept by the machine side
+	long long published;
+	long long dropped;
+};
+
+void InitializeExchange(FrameExchange &exchange);
+
+// Copies VRAM into the back buffer and makes it the newest frame; tag goes
+// along with it
+void PublishFrame(FrameExchange &exchange, const Machine &m, u32 tag);
+
+// The newest frame published since the last call, or NULL if there is none
+const u8 *TakeFrame(FrameExchange &exchange);
+
+// Tag of the frame TakeFrame() returned last
+inline u32 FrameTag(const FrameExchange &exchange)
+{
+	return exchange.tags[exchange.front];
+}
+
+#endif /*VIDEO_H*/